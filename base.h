@@ -110,6 +110,8 @@ static bool orca_is_valid_glyph(Glyph c) {
   case '?':
   case '$':
   case '&':
+  case '^':
+  case '|':
     return true;
   }
   return false;
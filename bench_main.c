@@ -0,0 +1,261 @@
+#include "base.h"
+#include "field.h"
+#include "gbuffer.h"
+#include "sim.h"
+#include "vmio.h"
+#include <dirent.h>
+#include <getopt.h>
+
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#undef SOKOL_IMPL
+
+// Headless benchmark for the VM. Runs orca_vm_run (or orca_run, with --scan)
+// over some .orca files and some generated grids, and reports how long it
+// took. Only the ticks themselves are timed -- loading, generating and
+// printing are outside of the measurement.
+
+static ORCA_NOINLINE void usage(void) { // clang-format off
+fprintf(stderr,
+"Usage: bench [options] [infile...]\n\n"
+"Runs the VM over each input file and over some generated grids, and prints\n"
+"the timing results. If no input files are given, every .orca file in\n"
+"examples/benchmarks/ is used.\n\n"
+"Options:\n"
+"    -t <number>        Number of timesteps to simulate per grid.\n"
+"                       Must be a positive integer.\n"
+"                       Default: 10000\n"
+"    --no-synthetic     Don't run the generated grids.\n"
+"    --scan             Use orca_run, which scans every cell, instead of\n"
+"                       orca_vm_run, which only visits operator cells.\n"
+"    -h or --help       Print this message and exit.\n"
+);} // clang-format on
+
+enum { Bench_max_files = 256 };
+
+static char const *const bench_default_dir = "examples/benchmarks";
+
+// Generated grids. 'live_permille' is how many cells out of 1000 are filled
+// with something other than '.', picked from the glyph soup below. The tick
+// count is divided by 'tick_divisor', so that the large grids don't dominate
+// the run time.
+typedef struct {
+  char const *name;
+  Usz height, width;
+  Usz live_permille;
+  Usz tick_divisor;
+} Synth_spec;
+
+static Synth_spec const synth_specs[] = {
+    {"synthetic:soup", 256, 256, 1000, 10},
+    {"synthetic:sparse", 256, 256, 20, 10},
+    {"synthetic:dots", 256, 256, 0, 10},
+    {"synthetic:arrangement", 512, 512, 1, 10},
+    {"synthetic:4096x4096", 4096, 4096, 20, 500},
+};
+
+// Operators, values and bangs.
+static char const synth_soup[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "abcdefghijklmnopqrstuvwxyz"
+                                 "0123456789"
+                                 "**#:%!?=$;&";
+
+// Small and deterministic, so that every run generates the same grids.
+static U32 synth_rand(U32 *state) {
+  U32 x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void synth_fill(Field *field, Synth_spec const *spec) {
+  field_init_fill(field, spec->height, spec->width, '.');
+  if (spec->live_permille == 0)
+    return;
+  U32 rng = 0x9e3779b9u;
+  Usz cells = spec->height * spec->width;
+  Glyph *buf = field->buffer;
+  for (Usz i = 0; i < cells; ++i) {
+    if (synth_rand(&rng) % 1000 >= spec->live_permille)
+      continue;
+    buf[i] = synth_soup[synth_rand(&rng) % (sizeof synth_soup - 1)];
+  }
+}
+
+typedef struct {
+  double secs;
+  Usz ticks;
+  Usz events;
+} Bench_result;
+
+static void bench_field(Field *field, Usz ticks, bool scan,
+                        Bench_result *out) {
+  Usz height = field->height, width = field->width;
+  Mbuf_reusable mbuf_r;
+  mbuf_reusable_init(&mbuf_r);
+  mbuf_reusable_ensure_size(&mbuf_r, height, width);
+  Oevent_list oevent_list;
+  oevent_list_init(&oevent_list);
+  Orca_vm vm;
+  orca_vm_init(&vm);
+  Usz events = 0;
+  U64 start = stm_now();
+  for (Usz i = 0; i < ticks; ++i) {
+    mbuffer_clear(mbuf_r.buffer, height, width);
+    oevent_list_clear(&oevent_list);
+    if (scan)
+      orca_run(&vm, field->buffer, mbuf_r.buffer, height, width, i,
+               &oevent_list, 0);
+    else
+      orca_vm_run(&vm, field->buffer, mbuf_r.buffer, height, width, i,
+                  &oevent_list, 0);
+    events += oevent_list.count;
+  }
+  out->secs = stm_sec(stm_since(start));
+  out->ticks = ticks;
+  out->events = events;
+  mbuf_reusable_deinit(&mbuf_r);
+  oevent_list_deinit(&oevent_list);
+  orca_vm_deinit(&vm);
+}
+
+static void print_header(void) {
+  printf("%-36s %11s %7s %12s %9s %11s\n", "grid", "size", "ticks",
+         "ticks/sec", "ns/cell", "events/tick");
+}
+
+static void print_result(char const *name, Usz height, Usz width,
+                         Bench_result const *r) {
+  char size[32];
+  snprintf(size, sizeof size, "%zux%zu", height, width);
+  double cells = (double)height * (double)width * (double)r->ticks;
+  double tps = r->secs > 0.0 ? (double)r->ticks / r->secs : 0.0;
+  double ns_per_cell = cells > 0.0 ? r->secs * 1e9 / cells : 0.0;
+  double ev_per_tick = r->ticks ? (double)r->events / (double)r->ticks : 0.0;
+  printf("%-36s %11s %7zu %12.1f %9.3f %11.2f\n", name, size, r->ticks, tps,
+         ns_per_cell, ev_per_tick);
+}
+
+static int path_cmp(void const *a, void const *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Collects the .orca files in a directory, sorted by name. Returned strings
+// must be freed by the caller.
+static Usz collect_orca_files(char const *dir_path, char **out_paths,
+                              Usz max_paths) {
+  DIR *dir = opendir(dir_path);
+  if (!dir)
+    return 0;
+  Usz count = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL && count < max_paths) {
+    char const *name = ent->d_name;
+    Usz len = strlen(name);
+    if (len <= 5 || strcmp(name + len - 5, ".orca") != 0)
+      continue;
+    Usz dir_len = strlen(dir_path);
+    char *path = malloc(dir_len + 1 + len + 1);
+    memcpy(path, dir_path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, len + 1);
+    out_paths[count++] = path;
+  }
+  closedir(dir);
+  qsort(out_paths, count, sizeof(char *), path_cmp);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  static struct option bench_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"no-synthetic", no_argument, 0, 's'},
+      {"scan", no_argument, 0, 'c'},
+      {NULL, 0, NULL, 0}};
+
+  int ticks = 10000;
+  bool use_synthetic = true;
+  bool scan = false;
+
+  for (;;) {
+    int c = getopt_long(argc, argv, "t:h", bench_options, NULL);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 't':
+      ticks = atoi(optarg);
+      if (ticks <= 0) {
+        fprintf(stderr,
+                "Bad timestep argument %s.\n"
+                "Must be a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      use_synthetic = false;
+      break;
+    case 'c':
+      scan = true;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    case '?':
+      usage();
+      return 1;
+    }
+  }
+
+  char *paths[Bench_max_files];
+  Usz path_count = 0;
+  bool paths_owned = false;
+  if (optind < argc) {
+    for (int i = optind; i < argc && path_count < Bench_max_files; ++i)
+      paths[path_count++] = argv[i];
+  } else {
+    path_count = collect_orca_files(bench_default_dir, paths, Bench_max_files);
+    paths_owned = true;
+    if (path_count == 0)
+      fprintf(stderr, "No .orca files found in %s.\n", bench_default_dir);
+  }
+
+  stm_setup();
+  print_header();
+  int exit_code = 0;
+  Field field;
+  Bench_result result;
+  for (Usz i = 0; i < path_count; ++i) {
+    field_init(&field);
+    Field_load_error fle = field_load_file(paths[i], &field);
+    if (fle != Field_load_error_ok) {
+      fprintf(stderr, "File load error: %s: %s.\n", paths[i],
+              field_load_error_string(fle));
+      field_deinit(&field);
+      exit_code = 1;
+      continue;
+    }
+    bench_field(&field, (Usz)ticks, scan, &result);
+    print_result(paths[i], field.height, field.width, &result);
+    field_deinit(&field);
+  }
+  if (use_synthetic) {
+    for (Usz i = 0; i < ORCA_ARRAY_COUNTOF(synth_specs); ++i) {
+      Synth_spec const *spec = &synth_specs[i];
+      Usz synth_ticks = (Usz)ticks / spec->tick_divisor;
+      if (synth_ticks == 0)
+        synth_ticks = 1;
+      synth_fill(&field, spec);
+      bench_field(&field, synth_ticks, scan, &result);
+      print_result(spec->name, field.height, field.width, &result);
+      field_deinit(&field);
+    }
+  }
+  if (paths_owned) {
+    for (Usz i = 0; i < path_count; ++i)
+      free(paths[i]);
+  }
+  return exit_code;
+}
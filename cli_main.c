@@ -12,18 +12,205 @@ fprintf(stderr,
 "    -t <number>   Number of timesteps to simulate.\n"
 "                  Must be 0 or a positive integer.\n"
 "                  Default: 1\n"
+"    --seed <number>\n"
+"                  Set the seed for the random function.\n"
+"                  Default: 1\n"
+"    --trace       Before the result, print the output events of each\n"
+"                  timestep that had any.\n"
+"    --events <file>\n"
+"                  Write every output event to a file, in a compact binary\n"
+"                  format. Use - for stdout, which also needs -q, and\n"
+"                  can't be used with --trace or --events-text -.\n"
+"    --events-text <file>\n"
+"                  Write every output event to a file, as text, in the same\n"
+"                  format as --trace. Use - for stdout.\n"
 "    -q or --quiet Don't print the result to stdout.\n"
 "    -h or --help  Print this message and exit.\n"
 );} // clang-format on
 
+// One line per event, with every field, so that traces can be diffed.
+static void print_oevents(FILE *f, Usz tick, Oevent_list const *olist) {
+  fprintf(f, "tick %zu\n", tick);
+  for (Oevent const *e = oevent_list_begin(olist); e;
+       e = oevent_list_next(olist, e)) {
+    switch ((Oevent_types)e->any.oevent_type) {
+    case Oevent_type_midi_note: {
+      Oevent_midi_note const *em = &e->midi_note;
+      fprintf(f, "  midi_note chan=%d oct=%d note=%d vel=%d dur=%d mono=%d\n",
+              em->channel, em->octave, em->note, em->velocity, em->duration,
+              em->mono);
+      break;
+    }
+    case Oevent_type_midi_cc: {
+      Oevent_midi_cc const *ec = &e->midi_cc;
+      fprintf(f, "  midi_cc chan=%d control=%d value=%d\n", ec->channel,
+              ec->control, ec->value);
+      break;
+    }
+    case Oevent_type_midi_cc_interpolated: {
+      Oevent_midi_cc_interpolated const *ec = &e->midi_cc_interpolated;
+      fprintf(f,
+              "  midi_cc_interpolated chan=%d control=%d target=%d rate=%d\n",
+              ec->channel, ec->control, ec->target_value,
+              ec->interpolation_rate);
+      break;
+    }
+    case Oevent_type_midi_pb: {
+      Oevent_midi_pb const *ep = &e->midi_pb;
+      fprintf(f, "  midi_pb chan=%d lsb=%d msb=%d\n", ep->channel, ep->lsb,
+              ep->msb);
+      break;
+    }
+    case Oevent_type_osc_ints: {
+      Oevent_osc_ints const *eo = &e->osc_ints;
+      U8 const *numbers = oevent_osc_ints_numbers(eo);
+      fprintf(f, "  osc_ints glyph=%c", eo->glyph);
+      for (Usz j = 0; j < eo->count; ++j)
+        fprintf(f, " %d", numbers[j]);
+      fputc('\n', f);
+      break;
+    }
+    case Oevent_type_udp_string: {
+      Oevent_udp_string const *eu = &e->udp_string;
+      fprintf(f, "  udp_string \"%.*s\"\n", (int)eu->count,
+              oevent_udp_string_chars(eu));
+      break;
+    }
+    default:
+      fprintf(f, "  unknown type=%d\n", e->any.oevent_type);
+      break;
+    }
+  }
+}
+
+// Binary event log written by --events. After an 8 byte header ("OEVT", a
+// version byte, and three zero bytes), each event is one record:
+//
+//   U32 tick, little-endian
+//   U8  type, from Oevent_types
+//   U8  payload size in bytes
+//   the payload: the event's fields in declaration order, without padding.
+//       For OSC and UDP events, only the used part of the array is written.
+//
+// The size byte lets a reader skip over event types it doesn't know.
+enum { Oevent_log_version = 1 };
+
+static void write_oevent_log_header(FILE *f) {
+  static U8 const header[8] = {'O', 'E', 'V', 'T', Oevent_log_version, 0, 0,
+                               0};
+  fwrite(header, 1, sizeof header, f);
+}
+
+static void write_oevent_log(FILE *f, Usz tick, Oevent_list const *olist) {
+  U8 rec[6 + 2 + Oevent_osc_int_count];
+  U32 t = (U32)tick;
+  rec[0] = (U8)t;
+  rec[1] = (U8)(t >> 8);
+  rec[2] = (U8)(t >> 16);
+  rec[3] = (U8)(t >> 24);
+  for (Oevent const *e = oevent_list_begin(olist); e;
+       e = oevent_list_next(olist, e)) {
+    U8 *p = rec + 6;
+    switch ((Oevent_types)e->any.oevent_type) {
+    case Oevent_type_midi_note: {
+      Oevent_midi_note const *em = &e->midi_note;
+      *p++ = em->channel;
+      *p++ = em->octave;
+      *p++ = em->note;
+      *p++ = em->velocity;
+      *p++ = em->duration;
+      *p++ = em->mono;
+      break;
+    }
+    case Oevent_type_midi_cc: {
+      Oevent_midi_cc const *ec = &e->midi_cc;
+      *p++ = ec->channel;
+      *p++ = ec->control;
+      *p++ = ec->value;
+      break;
+    }
+    case Oevent_type_midi_cc_interpolated: {
+      Oevent_midi_cc_interpolated const *ec = &e->midi_cc_interpolated;
+      *p++ = ec->channel;
+      *p++ = ec->control;
+      *p++ = ec->target_value;
+      *p++ = ec->interpolation_rate;
+      break;
+    }
+    case Oevent_type_midi_pb: {
+      Oevent_midi_pb const *ep = &e->midi_pb;
+      *p++ = ep->channel;
+      *p++ = ep->lsb;
+      *p++ = ep->msb;
+      break;
+    }
+    case Oevent_type_osc_ints: {
+      Oevent_osc_ints const *eo = &e->osc_ints;
+      Usz n = eo->count;
+      if (n > Oevent_osc_int_count)
+        n = Oevent_osc_int_count;
+      *p++ = (U8)eo->glyph;
+      *p++ = (U8)n;
+      memcpy(p, oevent_osc_ints_numbers(eo), n);
+      p += n;
+      break;
+    }
+    case Oevent_type_udp_string: {
+      Oevent_udp_string const *eu = &e->udp_string;
+      Usz n = eu->count;
+      if (n > Oevent_udp_string_count)
+        n = Oevent_udp_string_count;
+      *p++ = (U8)n;
+      memcpy(p, oevent_udp_string_chars(eu), n);
+      p += n;
+      break;
+    }
+    default:
+      break;
+    }
+    rec[4] = e->any.oevent_type;
+    rec[5] = (U8)(p - (rec + 6));
+    fwrite(rec, 1, (size_t)(p - rec), f);
+  }
+}
+
+static FILE *open_output_file(char const *path, char const *mode) {
+  if (strcmp(path, "-") == 0)
+    return stdout;
+  FILE *f = fopen(path, mode);
+  if (!f)
+    fprintf(stderr, "Unable to open %s for writing.\n", path);
+  return f;
+}
+
+static bool close_output_file(FILE *f, char const *path) {
+  bool ok = !ferror(f);
+  if (f == stdout)
+    ok = fflush(f) == 0 && ok;
+  else
+    ok = fclose(f) == 0 && ok;
+  if (!ok)
+    fprintf(stderr, "Error writing to %s.\n", path);
+  return ok;
+}
+
 int main(int argc, char **argv) {
   static struct option cli_options[] = {{"help", no_argument, 0, 'h'},
                                         {"quiet", no_argument, 0, 'q'},
+                                        {"seed", required_argument, 0, 's'},
+                                        {"trace", no_argument, 0, 'r'},
+                                        {"events", required_argument, 0, 'e'},
+                                        {"events-text", required_argument, 0,
+                                         'x'},
                                         {NULL, 0, NULL, 0}};
 
   char *input_file = NULL;
   int ticks = 1;
   bool print_output = true;
+  int seed = 1;
+  bool print_trace = false;
+  char const *events_path = NULL;
+  char const *events_text_path = NULL;
 
   for (;;) {
     int c = getopt_long(argc, argv, "t:qh", cli_options, NULL);
@@ -43,6 +230,25 @@ int main(int argc, char **argv) {
     case 'q':
       print_output = false;
       break;
+    case 'r':
+      print_trace = true;
+      break;
+    case 'e':
+      events_path = optarg;
+      break;
+    case 'x':
+      events_text_path = optarg;
+      break;
+    case 's':
+      seed = atoi(optarg);
+      if (seed < 1 && strcmp(optarg, "0")) {
+        fprintf(stderr,
+                "Bad seed argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
     case 'h':
       usage();
       return 0;
@@ -70,6 +276,14 @@ int main(int argc, char **argv) {
     usage();
     return 1;
   }
+  // The binary log can't share stdout with anything else.
+  if (events_path && strcmp(events_path, "-") == 0 &&
+      (print_output || print_trace ||
+       (events_text_path && strcmp(events_text_path, "-") == 0))) {
+    fprintf(stderr, "--events - needs -q, and can't be used with --trace or "
+                    "--events-text -.\n");
+    return 1;
+  }
 
   Field field;
   field_init(&field);
@@ -79,22 +293,57 @@ int main(int argc, char **argv) {
     fprintf(stderr, "File load error: %s.\n", field_load_error_string(fle));
     return 1;
   }
+  FILE *events_file = NULL, *events_text_file = NULL;
+  if (events_path) {
+    events_file = open_output_file(events_path, "wb");
+    if (!events_file) {
+      field_deinit(&field);
+      return 1;
+    }
+    write_oevent_log_header(events_file);
+  }
+  if (events_text_path) {
+    events_text_file = open_output_file(events_text_path, "w");
+    if (!events_text_file) {
+      if (events_file)
+        close_output_file(events_file, events_path);
+      field_deinit(&field);
+      return 1;
+    }
+  }
   Mbuf_reusable mbuf_r;
   mbuf_reusable_init(&mbuf_r);
   mbuf_reusable_ensure_size(&mbuf_r, field.height, field.width);
   Oevent_list oevent_list;
   oevent_list_init(&oevent_list);
+  Orca_vm vm;
+  orca_vm_init(&vm);
   Usz max_ticks = (Usz)ticks;
   for (Usz i = 0; i < max_ticks; ++i) {
     mbuffer_clear(mbuf_r.buffer, field.height, field.width);
     oevent_list_clear(&oevent_list);
-    orca_run(field.buffer, mbuf_r.buffer, field.height, field.width, i,
-             &oevent_list, 0);
+    orca_vm_run(&vm, field.buffer, mbuf_r.buffer, field.height, field.width, i,
+                &oevent_list, (Usz)seed);
+    if (oevent_list.count == 0)
+      continue;
+    if (print_trace)
+      print_oevents(stdout, i, &oevent_list);
+    if (events_file)
+      write_oevent_log(events_file, i, &oevent_list);
+    if (events_text_file)
+      print_oevents(events_text_file, i, &oevent_list);
   }
+  int exit_code = 0;
+  if (events_file && !close_output_file(events_file, events_path))
+    exit_code = 1;
+  if (events_text_file &&
+      !close_output_file(events_text_file, events_text_path))
+    exit_code = 1;
+  orca_vm_deinit(&vm);
   mbuf_reusable_deinit(&mbuf_r);
   oevent_list_deinit(&oevent_list);
   if (print_output)
     field_fput(&field, stdout);
   field_deinit(&field);
-  return 0;
+  return exit_code;
 }
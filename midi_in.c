@@ -0,0 +1,210 @@
+#include "midi_in.h"
+#include "midi_out.h"
+
+// Loop gains, per pulse. For a critically damped loop with a bandwidth of w
+// radians per pulse, the phase gain is sqrt(2) * w and the period gain is
+// w * w. w = 0.05 is about 0.4 Hz at 120 BPM: slow enough to bring jitter of
+// +/-2 ms down to under 1 ms, fast enough to follow a tempo ramp. See
+// tests/midi_in_test.c.
+#define MIDI_CLOCK_PLL_PHASE_GAIN 0.07
+#define MIDI_CLOCK_PLL_PERIOD_GAIN 0.0025
+
+void midi_clock_pll_reset(Midi_clock_pll *pll) {
+  pll->last = 0;
+  pll->period = 0.0;
+  pll->pulses = 0;
+}
+
+U64 midi_clock_pll_pulse(Midi_clock_pll *pll, U64 time) {
+  if (pll->pulses == 2) {
+    double err = (double)(I64)(time - pll->last) - pll->period;
+    if (err <= pll->period && err >= -pll->period) {
+      pll->last += (U64)(pll->period + MIDI_CLOCK_PLL_PHASE_GAIN * err);
+      pll->period += MIDI_CLOCK_PLL_PERIOD_GAIN * err;
+      return pll->last;
+    }
+    pll->pulses = 0;
+  }
+  // The first interval is the starting guess for the period.
+  if (pll->pulses == 1 && time > pll->last) {
+    pll->period = (double)(time - pll->last);
+    pll->pulses = 2;
+  } else {
+    pll->pulses = 1;
+  }
+  pll->last = time;
+  return time;
+}
+
+double midi_clock_pll_bpm(Midi_clock_pll const *pll) {
+  if (pll->pulses < 2 || pll->period <= 0.0)
+    return 0.0;
+  return 60e9 / (pll->period * 24.0);
+}
+
+void midi_clock_ring_init(Midi_clock_ring *ring) {
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+bool midi_clock_ring_push(Midi_clock_ring *ring, Midi_clock_event const *ev) {
+  U32 head = ring->head; // Only this thread writes it
+  U32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail == MIDI_CLOCK_RING_SIZE)
+    return false;
+  ring->events[head & (MIDI_CLOCK_RING_SIZE - 1)] = *ev;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+Usz midi_clock_ring_pop(Midi_clock_ring *ring, Midi_clock_event *out,
+                        Usz max) {
+  U32 tail = ring->tail; // Only this thread writes it
+  U32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  Usz count = 0;
+  while (tail != head && count < max) {
+    out[count++] = ring->events[tail & (MIDI_CLOCK_RING_SIZE - 1)];
+    ++tail;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  return count;
+}
+
+#ifdef FEAT_PORTMIDI
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+void midi_clock_in_init(Midi_clock_in *mci) {
+  mci->stream = NULL;
+  mci->device_id = 0;
+  midi_clock_pll_reset(&mci->pll);
+  midi_clock_ring_init(&mci->ring);
+  mci->wake_fd = -1;
+  mci->quit = false;
+}
+
+void midi_clock_in_deinit(Midi_clock_in *mci) {
+  if (mci->stream) {
+    __atomic_store_n(&mci->quit, true, __ATOMIC_RELEASE);
+    pthread_join(mci->thread, NULL);
+    portmidi_lock();
+    Pm_Close(mci->stream);
+    portmidi_unlock();
+  }
+  midi_clock_in_init(mci);
+}
+
+// Turns what PortMidi read into clock events, and pushes them to the ring.
+// Returns true if there were any.
+static bool midi_clock_in_push_events(Midi_clock_in *mci,
+                                      PmEvent const *events, int count) {
+  bool pushed = false;
+  for (int i = 0; i < count; ++i) {
+    PmMessage msg = events[i].message;
+    Midi_clock_event ev;
+    ev.song_position = 0;
+    ev.time = portmidi_time_of_timestamp(events[i].timestamp);
+    ev.bpm = 0.0;
+    switch (Pm_MessageStatus(msg)) {
+    case 0xF8: // Timing clock
+      ev.type = Midi_clock_event_pulse;
+      ev.time = midi_clock_pll_pulse(&mci->pll, ev.time);
+      ev.bpm = midi_clock_pll_bpm(&mci->pll);
+      break;
+    case 0xFA:
+      ev.type = Midi_clock_event_start;
+      break;
+    case 0xFB:
+      ev.type = Midi_clock_event_continue;
+      break;
+    case 0xFC:
+      ev.type = Midi_clock_event_stop;
+      break;
+    case 0xF2: // Song position pointer, 14 bits, low 7 first
+      ev.type = Midi_clock_event_song_position;
+      ev.song_position =
+          (U16)(Pm_MessageData1(msg) | Pm_MessageData2(msg) << 7);
+      break;
+    default:
+      continue;
+    }
+    // If the stepping side has fallen this far behind, a dropped pulse is the
+    // least of its problems.
+    midi_clock_ring_push(&mci->ring, &ev);
+    pushed = true;
+  }
+  return pushed;
+}
+
+static void *midi_clock_in_thread(void *arg) {
+  Midi_clock_in *mci = arg;
+  PmEvent events[32];
+  while (!__atomic_load_n(&mci->quit, __ATOMIC_ACQUIRE)) {
+    bool pushed = false;
+    for (;;) {
+      portmidi_lock();
+      int got = Pm_Read(mci->stream, events, (I32)ORCA_ARRAY_COUNTOF(events));
+      portmidi_unlock();
+      // Negative is an error, like the buffer having overflowed. Whatever was
+      // lost is lost, and the PLL will catch up with the pulses after it.
+      if (got <= 0)
+        break;
+      pushed |= midi_clock_in_push_events(mci, events, got);
+      if (got < (int)ORCA_ARRAY_COUNTOF(events))
+        break;
+    }
+    if (pushed && mci->wake_fd != -1) {
+      char b = 0;
+      ssize_t res = write(mci->wake_fd, &b, 1);
+      (void)res; // If the pipe is full, the reader is already going to wake.
+    }
+    struct timespec ts = {0, (long)MIDI_CLOCK_IN_POLL_NS};
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+  }
+  return NULL;
+}
+
+PmError midi_clock_in_open(Midi_clock_in *mci, PmDeviceID dev_id,
+                           int wake_fd) {
+  midi_clock_in_deinit(mci);
+  PmError e = portmidi_init_if_necessary();
+  if (e)
+    return e;
+  portmidi_lock();
+  // Same clock as the output streams, so that arrival times can be compared
+  // with send times.
+  e = Pm_OpenInput(&mci->stream, dev_id, NULL, 256, portmidi_timeproc, NULL);
+  if (e) {
+    portmidi_unlock();
+    mci->stream = NULL;
+    return e;
+  }
+  // Only the realtime and song position messages are wanted. Dropping the
+  // rest before they're buffered leaves room for them if the sender is also
+  // playing notes.
+  Pm_SetFilter(mci->stream, PM_FILT_ACTIVE | PM_FILT_SYSEX | PM_FILT_NOTE |
+                                PM_FILT_AFTERTOUCH | PM_FILT_PROGRAM |
+                                PM_FILT_CONTROL | PM_FILT_PITCHBEND |
+                                PM_FILT_MTC);
+  portmidi_unlock();
+  mci->wake_fd = wake_fd;
+  if (pthread_create(&mci->thread, NULL, midi_clock_in_thread, mci)) {
+    portmidi_lock();
+    Pm_Close(mci->stream);
+    portmidi_unlock();
+    mci->stream = NULL;
+    mci->wake_fd = -1;
+    return pmInsufficientMemory;
+  }
+  mci->device_id = dev_id;
+  return pmNoError;
+}
+
+Usz midi_clock_in_read(Midi_clock_in *mci, Midi_clock_event *out, Usz max) {
+  if (!mci->stream)
+    return 0;
+  return midi_clock_ring_pop(&mci->ring, out, max);
+}
+#endif
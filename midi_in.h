@@ -0,0 +1,101 @@
+#pragma once
+#include "base.h"
+
+#ifdef FEAT_PORTMIDI
+#include <portmidi.h>
+#include <pthread.h>
+#endif
+
+// Follows an incoming MIDI beat clock, which has 24 pulses per quarter note.
+// The pulses arrive with jitter from the sender, the driver and the cable, so
+// their times go through a second-order phase-locked loop: it predicts when
+// the next pulse is due from an estimate of the pulse period, and corrects
+// both the prediction and the period by a fraction of how far off each pulse
+// was. The corrected pulse times are steady enough to schedule output against,
+// and the period gives the tempo.
+typedef struct {
+  U64 last;      // Corrected time of the most recent pulse
+  double period; // Estimated nanoseconds between pulses
+  U8 pulses;     // Pulses seen since the loop was last reset, up to 2
+} Midi_clock_pll;
+
+void midi_clock_pll_reset(Midi_clock_pll *pll);
+// Feeds in the arrival time of a pulse, from midi_clock_now_ns(), and returns
+// the corrected time of that pulse. A pulse that's off by more than a whole
+// period (the sender jumped to a very different tempo, or paused) restarts
+// the loop from it.
+U64 midi_clock_pll_pulse(Midi_clock_pll *pll, U64 time);
+// Returns 0 until there have been enough pulses to tell.
+double midi_clock_pll_bpm(Midi_clock_pll const *pll);
+
+typedef enum {
+  Midi_clock_event_pulse,
+  Midi_clock_event_start,
+  Midi_clock_event_continue,
+  Midi_clock_event_stop,
+  Midi_clock_event_song_position,
+} Midi_clock_event_type;
+
+typedef struct {
+  Midi_clock_event_type type;
+  U16 song_position; // In 16th notes. Only for Midi_clock_event_song_position
+  U64 time;          // From midi_clock_now_ns(). PLL-corrected for pulses
+  double bpm;        // Only for pulses. From the PLL, 0 until it can tell
+} Midi_clock_event;
+
+// Passes clock events from one thread to another without a lock, and without
+// either of them ever waiting for the other. Only one thread may push, and
+// only one other thread may pop.
+#define MIDI_CLOCK_RING_SIZE 256 // Has to be a power of two
+typedef struct {
+  Midi_clock_event events[MIDI_CLOCK_RING_SIZE];
+  U32 head; // Incremented by the pushing thread after it writes an event
+  U32 tail; // Incremented by the popping thread after it reads one
+} Midi_clock_ring;
+
+void midi_clock_ring_init(Midi_clock_ring *ring);
+// Returns false, and drops the event, if the ring is full.
+bool midi_clock_ring_push(Midi_clock_ring *ring, Midi_clock_event const *ev);
+// Returns how many events were written to out, up to max.
+Usz midi_clock_ring_pop(Midi_clock_ring *ring, Midi_clock_event *out,
+                        Usz max);
+
+#ifdef FEAT_PORTMIDI
+// While open, a thread of its own reads the input, so that the messages are
+// read (and the PLL kept up) however long whoever is stepping the grid takes
+// to get around to them. It only takes the PortMidi lock, and hands the
+// events over through the ring.
+typedef struct {
+  PortMidiStream *stream; // Null when closed
+  PmDeviceID device_id;
+  Midi_clock_pll pll; // Only used by the reading thread
+  Midi_clock_ring ring;
+  pthread_t thread;
+  int wake_fd; // Written to after pushing events to the ring, unless -1
+  bool quit;   // Tells the reading thread to stop. Accessed atomically
+} Midi_clock_in;
+
+// PortMidi can't wait for input, so the reading thread looks for new messages
+// every MIDI_CLOCK_IN_POLL_NS. A message can wait that long to be read, and
+// then some more for the threads to be scheduled, before it's returned by
+// midi_clock_in_read(). Its time is still when it arrived, so anything sent
+// because of it has to be scheduled at least MIDI_CLOCK_IN_DELAY_NS later.
+// Otherwise it would be stamped with a time that has already passed, and
+// PortMidi sends those straight away, so the output would be as uneven as
+// the polling.
+#define MIDI_CLOCK_IN_POLL_NS UINT64_C(1000000)
+#define MIDI_CLOCK_IN_DELAY_NS (MIDI_CLOCK_IN_POLL_NS * 2)
+
+void midi_clock_in_init(Midi_clock_in *mci);
+void midi_clock_in_deinit(Midi_clock_in *mci);
+// Closes the input first if it's already open. Opening, closing and reading
+// have to be done from the same thread, or under a lock of the caller's. If
+// wake_fd isn't -1, a byte is written to it whenever there's something new to
+// read, so that the reader can wait on it instead of polling. It should be
+// non-blocking, and it's not closed by the input.
+PmError midi_clock_in_open(Midi_clock_in *mci, PmDeviceID dev_id, int wake_fd);
+// Returns the clock messages that have arrived since the last call, up to max
+// of them, without waiting for any. Other messages are thrown away. The times
+// are when PortMidi received them, not when they were read.
+Usz midi_clock_in_read(Midi_clock_in *mci, Midi_clock_event *out, Usz max);
+#endif
@@ -0,0 +1,413 @@
+#include "midi_out.h"
+#include "oso.h"
+#include <errno.h>
+#include <time.h>
+
+#ifdef FEAT_PORTMIDI
+#include <pthread.h>
+#endif
+
+U64 midi_clock_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (U64)ts.tv_sec * UINT64_C(1000000000) + (U64)ts.tv_nsec;
+}
+
+void midi_mode_init_null(Midi_mode *mm) { mm->any.type = Midi_mode_type_null; }
+void midi_mode_init_osc_bidule(Midi_mode *mm, char const *path) {
+  mm->osc_bidule.type = Midi_mode_type_osc_bidule;
+  mm->osc_bidule.path = path;
+}
+#ifdef FEAT_PORTMIDI
+// Not sure whether it's OK to call Pm_Terminate() without having a successful
+// call to Pm_Initialize() -- let's just treat it with tweezers.
+static bool portmidi_is_initialized = false;
+static pthread_mutex_t portmidi_mutex = PTHREAD_MUTEX_INITIALIZER;
+void portmidi_lock(void) { pthread_mutex_lock(&portmidi_mutex); }
+void portmidi_unlock(void) { pthread_mutex_unlock(&portmidi_mutex); }
+static struct {
+  U64 clock_base;
+  bool did_init;
+} portmidi_global_data;
+static U64 portmidi_clock_base(void) {
+  if (!portmidi_global_data.did_init) {
+    portmidi_global_data.did_init = true;
+    portmidi_global_data.clock_base = midi_clock_now_ns();
+  }
+  return portmidi_global_data.clock_base;
+}
+static PmTimestamp portmidi_timestamp_now(void) {
+  U64 base = portmidi_clock_base();
+  return (PmTimestamp)((midi_clock_now_ns() - base) / UINT64_C(1000000));
+}
+// time_ns is from midi_clock_now_ns(). Times from before PortMidi's clock
+// started are clamped to its start.
+static PmTimestamp portmidi_timestamp_at(U64 time_ns) {
+  U64 base = portmidi_clock_base();
+  if (time_ns <= base)
+    return 0;
+  return (PmTimestamp)((time_ns - base) / UINT64_C(1000000));
+}
+U64 portmidi_time_of_timestamp(PmTimestamp timestamp) {
+  U64 base = portmidi_clock_base();
+  if (timestamp <= 0)
+    return base;
+  return base + (U64)timestamp * UINT64_C(1000000);
+}
+PmTimestamp portmidi_timeproc(void *time_info) {
+  (void)time_info;
+  return portmidi_timestamp_now();
+}
+PmError portmidi_init_if_necessary(void) {
+  PmError e = pmNoError;
+  portmidi_lock();
+  if (portmidi_is_initialized)
+    goto done;
+  e = Pm_Initialize();
+  if (e)
+    goto done;
+  portmidi_is_initialized = true;
+  // The clock has to be started before any streams are, so that the first
+  // timestamps written to them aren't in the future, and so that PortMidi
+  // doesn't start it from one of its own threads.
+  portmidi_clock_base();
+done:
+  portmidi_unlock();
+  return e;
+}
+void portmidi_terminate_if_necessary(void) {
+  portmidi_lock();
+  if (portmidi_is_initialized) {
+    Pm_Terminate();
+    portmidi_is_initialized = false;
+  }
+  portmidi_unlock();
+}
+PmError midi_mode_init_portmidi(Midi_mode *mm, PmDeviceID dev_id,
+                                I32 latency) {
+  PmError e = portmidi_init_if_necessary();
+  if (e)
+    goto fail;
+  if (latency < 0)
+    latency = 0;
+  // With a latency, messages wait in this buffer until they're due, so leave
+  // room for a few dense ticks.
+  portmidi_lock();
+  e = Pm_OpenOutput(&mm->portmidi.stream, dev_id, NULL, 1024,
+                    portmidi_timeproc, NULL, latency);
+  portmidi_unlock();
+  if (e)
+    goto fail;
+  mm->portmidi.type = Midi_mode_type_portmidi;
+  mm->portmidi.device_id = dev_id;
+  mm->portmidi.latency = latency;
+  mm->portmidi.send_time = 0;
+  mm->portmidi.batch = NULL;
+  mm->portmidi.batch_count = mm->portmidi.batch_capacity = 0;
+  mm->portmidi.is_batching = false;
+  return pmNoError;
+fail:
+  midi_mode_init_null(mm);
+  return e;
+}
+// Returns true on success.
+bool portmidi_find_device_id_by_name(char const *name, Usz namelen, bool input,
+                                     PmError *out_pmerror,
+                                     PmDeviceID *out_id) {
+  *out_pmerror = portmidi_init_if_necessary();
+  if (*out_pmerror)
+    return false;
+  bool found = false;
+  portmidi_lock();
+  int num = Pm_CountDevices();
+  for (int i = 0; i < num; ++i) {
+    PmDeviceInfo const *info = Pm_GetDeviceInfo(i);
+    if (!info || !(input ? info->input : info->output))
+      continue;
+    Usz len = strlen(info->name);
+    if (len != namelen)
+      continue;
+    if (strncmp(name, info->name, namelen) == 0) {
+      *out_id = i;
+      found = true;
+      break;
+    }
+  }
+  portmidi_unlock();
+  return found;
+}
+bool portmidi_find_name_of_device_id(PmDeviceID id, bool input,
+                                     PmError *out_pmerror, oso **out_name) {
+  *out_pmerror = portmidi_init_if_necessary();
+  if (*out_pmerror)
+    return false;
+  bool found = false;
+  portmidi_lock();
+  int num = Pm_CountDevices();
+  if (id >= 0 && id < num) {
+    PmDeviceInfo const *info = Pm_GetDeviceInfo(id);
+    if (info && (input ? info->input : info->output)) {
+      osoput(out_name, info->name);
+      found = true;
+    }
+  }
+  portmidi_unlock();
+  return found;
+}
+#endif
+void midi_mode_deinit(Midi_mode *mm) {
+  switch (mm->any.type) {
+  case Midi_mode_type_null:
+  case Midi_mode_type_osc_bidule:
+    break;
+#ifdef FEAT_PORTMIDI
+  case Midi_mode_type_portmidi:
+    // Because PortMidi seems to work correctly ony more platforms when using
+    // its timing stuff, we are using it. And because we are using it, and
+    // because it may be buffering events for sending 'later', we might have
+    // pending outgoing MIDI events. We'll need to wait until they finish being
+    // before calling Pm_Close, otherwise users could have problems like MIDI
+    // notes being stuck on. Nothing is stamped later than the current time,
+    // so waiting for the latency is enough.
+    {
+      I32 latency = mm->portmidi.latency;
+      struct timespec ts;
+      ts.tv_sec = latency / 1000;
+      ts.tv_nsec = (long)(latency % 1000) * 1000000L;
+      while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+      }
+    }
+    portmidi_lock();
+    Pm_Close(mm->portmidi.stream);
+    portmidi_unlock();
+    free(mm->portmidi.batch);
+    break;
+#endif
+  }
+}
+
+void midi_mode_set_send_time(Midi_mode *mm, U64 time_ns) {
+#ifdef FEAT_PORTMIDI
+  if (mm->any.type == Midi_mode_type_portmidi)
+    mm->portmidi.send_time = time_ns;
+#else
+  (void)mm;
+  (void)time_ns;
+#endif
+}
+
+void midi_mode_begin_batch(Midi_mode *mm) {
+#ifdef FEAT_PORTMIDI
+  if (mm->any.type == Midi_mode_type_portmidi)
+    mm->portmidi.is_batching = true;
+#else
+  (void)mm;
+#endif
+}
+
+void midi_mode_end_batch(Midi_mode *mm) {
+#ifdef FEAT_PORTMIDI
+  if (mm->any.type != Midi_mode_type_portmidi)
+    return;
+  Midi_mode_portmidi *pm = &mm->portmidi;
+  pm->is_batching = false;
+  if (pm->batch_count == 0)
+    return;
+  portmidi_lock();
+  PmError pme = Pm_Write(pm->stream, pm->batch, (I32)pm->batch_count);
+  portmidi_unlock();
+  (void)pme;
+  pm->batch_count = 0;
+#else
+  (void)mm;
+#endif
+}
+
+// early_ns moves the message's timestamp back from the send time, for
+// note-offs of notes that ran out before it.
+static void send_midi_3bytes(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                             U64 early_ns, int status, int byte1, int byte2) {
+#ifndef FEAT_PORTMIDI
+  (void)early_ns;
+#endif
+  switch (midi_mode->any.type) {
+  case Midi_mode_type_null:
+    break;
+  case Midi_mode_type_osc_bidule: {
+    if (!oosc_dev)
+      break;
+    oosc_send_int32s(oosc_dev, midi_mode->osc_bidule.path,
+                     (int[]){status, byte1, byte2}, 3);
+    break;
+  }
+#ifdef FEAT_PORTMIDI
+  case Midi_mode_type_portmidi: {
+    // With a nonzero latency, PortMidi delivers the message at its timestamp
+    // plus the latency. Stamping it with the time it belongs to, instead of
+    // with the time we got around to sending it, means any lateness in our
+    // own loop that's shorter than the latency doesn't show up as jitter.
+    Midi_mode_portmidi *pm = &midi_mode->portmidi;
+    U64 send_time = pm->send_time;
+    PmTimestamp pm_timestamp;
+    if (send_time == 0)
+      pm_timestamp = portmidi_timestamp_now();
+    else
+      pm_timestamp = portmidi_timestamp_at(
+          send_time > early_ns ? send_time - early_ns : 0);
+    PmMessage msg = Pm_Message(status, byte1, byte2);
+    if (!pm->is_batching) {
+      portmidi_lock();
+      PmError pme = Pm_WriteShort(pm->stream, pm_timestamp, msg);
+      portmidi_unlock();
+      (void)pme;
+      break;
+    }
+    if (pm->batch_count == pm->batch_capacity) {
+      Usz cap = pm->batch_capacity ? pm->batch_capacity * 2 : 64;
+      pm->batch = realloc(pm->batch, cap * sizeof(PmEvent));
+      pm->batch_capacity = cap;
+    }
+    pm->batch[pm->batch_count++] =
+        (PmEvent){.message = msg, .timestamp = pm_timestamp};
+    break;
+  }
+#endif
+  }
+}
+
+void send_midi_chan_msg(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                        int type /*0..15*/, int chan /*0.. 15*/,
+                        int byte1 /*0..127*/, int byte2 /*0..127*/) {
+  send_midi_3bytes(oosc_dev, midi_mode, 0, type << 4 | chan, byte1, byte2);
+}
+
+void send_midi_byte(Oosc_dev *oosc_dev, Midi_mode *midi_mode, int x) {
+  // PortMidi wants 0 and 0 for the unused bytes. Likewise, Bidule's
+  // MIDI-via-OSC won't accept the message unless there are at least all 3
+  // bytes, with the second 2 set to zero.
+  send_midi_3bytes(oosc_dev, midi_mode, 0, x, 0, 0);
+}
+
+void send_midi_note_offs(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                         Susnote const *start, Susnote const *end) {
+  for (; start != end; ++start) {
+    // A negative remaining time is how long ago the note ran out.
+    float under = start->remaining;
+    U64 early_ns = under < 0.0f ? (U64)((double)-under * 1e9) : 0;
+    U16 chan_note = start->chan_note;
+    send_midi_3bytes(oosc_dev, midi_mode, early_ns, 0x8 << 4 | chan_note >> 8,
+                     chan_note & 0xFF, 0);
+  }
+}
+
+void apply_time_to_sustained_notes(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                                   double time_elapsed,
+                                   Susnote_list *susnote_list,
+                                   double *next_note_off_deadline) {
+  Usz removed = susnote_list_advance_time(susnote_list, time_elapsed,
+                                          next_note_off_deadline);
+  if (ORCA_UNLIKELY(removed > 0)) {
+    Susnote const *restrict susnotes_off = susnote_list->removed;
+    midi_mode_begin_batch(midi_mode);
+    send_midi_note_offs(oosc_dev, midi_mode, susnotes_off,
+                        susnotes_off + removed);
+    midi_mode_end_batch(midi_mode);
+  }
+}
+
+// Everything goes out in the order the VM emitted it. A note-on for a note
+// that's still sustained first turns the old one off. A 'mono' note first
+// turns off every note sustained on its channel, and if several mono notes
+// for the same channel come in one tick, only the last one is played. Other
+// notes for a channel that has a mono note in the same tick aren't played at
+// all, wherever they come in the tick, so that the mono note is the only one
+// left sounding on its channel.
+
+void send_output_events(Oosc_dev *oosc_dev, Midi_mode *midi_mode, Usz bpm,
+                        Susnote_list *susnote_list, Orca_vm *vm,
+                        Oevent_list const *oevent_list) {
+  double frame_secs = 60.0 / (double)bpm / 4.0;
+  // The last mono note for each channel, or NULL if none.
+  Oevent const *last_mono[16] = {NULL};
+  for (Oevent const *e = oevent_list_begin(oevent_list); e;
+       e = oevent_list_next(oevent_list, e)) {
+    if (e->any.oevent_type == Oevent_type_midi_note && e->midi_note.mono &&
+        e->midi_note.channel < 16)
+      last_mono[e->midi_note.channel] = e;
+  }
+
+  midi_mode_begin_batch(midi_mode);
+  for (Oevent const *e = oevent_list_begin(oevent_list); e;
+       e = oevent_list_next(oevent_list, e)) {
+    switch ((Oevent_types)e->any.oevent_type) {
+    case Oevent_type_midi_note: {
+      Oevent_midi_note const *em = &e->midi_note;
+      Usz channel = em->channel;
+      if (channel > 15)
+        break;
+      Usz note_number = (Usz)(12u * em->octave + em->note);
+      if (note_number > 127)
+        note_number = 127;
+      if (last_mono[channel] && last_mono[channel] != e)
+        break;
+      Usz removed;
+      if (em->mono) {
+        removed =
+            susnote_list_remove_by_chan_mask(susnote_list, (Usz)1 << channel);
+        send_midi_note_offs(oosc_dev, midi_mode, susnote_list->removed,
+                            susnote_list->removed + removed);
+      }
+      Susnote sn = {.remaining = (float)(frame_secs * (double)em->duration),
+                    .chan_note = (U16)((channel << 8u) | note_number)};
+      removed = susnote_list_add_notes(susnote_list, &sn, 1);
+      send_midi_note_offs(oosc_dev, midi_mode, susnote_list->removed,
+                          susnote_list->removed + removed);
+      send_midi_chan_msg(oosc_dev, midi_mode, 0x9, (int)channel,
+                         (int)note_number, em->velocity);
+      break;
+    }
+    case Oevent_type_midi_cc: {
+      Oevent_midi_cc const *ec = &e->midi_cc;
+      send_midi_chan_msg(oosc_dev, midi_mode, 0xb, ec->channel, ec->control,
+                         ec->value);
+      set_midi_cc_value(vm, ec->channel, ec->control, ec->value);
+      break;
+    }
+    case Oevent_type_midi_cc_interpolated: {
+      Oevent_midi_cc_interpolated const *eci = &e->midi_cc_interpolated;
+      // Starts a ramp, which advance_midi_cc_interpolations() turns into
+      // plain MIDI CC events.
+      process_interpolated_midi_cc_event(vm, eci, frame_secs);
+      break;
+    }
+    case Oevent_type_midi_pb: {
+      Oevent_midi_pb const *ep = &e->midi_pb;
+      send_midi_chan_msg(oosc_dev, midi_mode, 0xe, ep->channel, ep->lsb,
+                         ep->msb);
+      break;
+    }
+    case Oevent_type_osc_ints: {
+      if (!oosc_dev)
+        break;
+      Oevent_osc_ints const *eo = &e->osc_ints;
+      char path[] = {'/', eo->glyph, '\0'};
+      U8 const *numbers = oevent_osc_ints_numbers(eo);
+      I32 ints[Oevent_osc_int_count];
+      Usz nnum = eo->count;
+      for (Usz inum = 0; inum < nnum; ++inum) {
+        ints[inum] = numbers[inum];
+      }
+      oosc_send_int32s(oosc_dev, path, ints, nnum);
+      break;
+    }
+    case Oevent_type_udp_string: {
+      if (!oosc_dev)
+        break;
+      Oevent_udp_string const *eu = &e->udp_string;
+      oosc_send_datagram(oosc_dev, oevent_udp_string_chars(eu), eu->count);
+      break;
+    }
+    }
+  }
+  midi_mode_end_batch(midi_mode);
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "base.h"
+#include "osc_out.h"
+#include "sim.h"
+#include "vmio.h"
+
+#ifdef FEAT_PORTMIDI
+#include <portmidi.h>
+#endif
+
+struct oso;
+
+// Where outgoing MIDI goes. Sending to OSC (for Plogue Bidule) goes through
+// the Oosc_dev that's passed along with it, so that the same UDP socket can be
+// shared with the plain OSC output.
+typedef enum {
+  Midi_mode_type_null,
+  Midi_mode_type_osc_bidule,
+#ifdef FEAT_PORTMIDI
+  Midi_mode_type_portmidi,
+#endif
+} Midi_mode_type;
+
+typedef struct {
+  Midi_mode_type type;
+} Midi_mode_any;
+
+typedef struct {
+  Midi_mode_type type;
+  char const *path;
+} Midi_mode_osc_bidule;
+
+#ifdef FEAT_PORTMIDI
+typedef struct {
+  Midi_mode_type type;
+  PmDeviceID device_id;
+  PortMidiStream *stream;
+  I32 latency;   // In milliseconds. 0 means timestamps are ignored.
+  U64 send_time; // See midi_mode_set_send_time()
+  // Messages collected between midi_mode_begin_batch() and
+  // midi_mode_end_batch().
+  PmEvent *batch;
+  Usz batch_count, batch_capacity;
+  bool is_batching;
+} Midi_mode_portmidi;
+#endif
+
+typedef union {
+  Midi_mode_any any;
+  Midi_mode_osc_bidule osc_bidule;
+#ifdef FEAT_PORTMIDI
+  Midi_mode_portmidi portmidi;
+#endif
+} Midi_mode;
+
+void midi_mode_init_null(Midi_mode *mm);
+void midi_mode_init_osc_bidule(Midi_mode *mm, char const *path);
+void midi_mode_deinit(Midi_mode *mm);
+
+// In milliseconds. Defined even without PortMidi, so that options for it can
+// be parsed either way.
+enum {
+  Portmidi_default_latency = 1,
+};
+
+#ifdef FEAT_PORTMIDI
+// PortMidi can't be called from more than one thread at a time. The functions
+// here and in midi_in.h take this lock themselves around their PortMidi calls;
+// anything else that calls Pm_ functions directly has to take it too. It's
+// separate from any lock of the caller's, so that reading the clock input
+// never waits for the UI.
+void portmidi_lock(void);
+void portmidi_unlock(void);
+PmError portmidi_init_if_necessary(void);
+void portmidi_terminate_if_necessary(void);
+// latency is in milliseconds. Messages are delivered that long after the time
+// they're stamped with, which absorbs any lateness in when we send them.
+PmError midi_mode_init_portmidi(Midi_mode *mm, PmDeviceID dev_id,
+                                I32 latency);
+// input picks whether input or output devices are searched.
+bool portmidi_find_device_id_by_name(char const *name, Usz namelen, bool input,
+                                     PmError *out_pmerror, PmDeviceID *out_id);
+bool portmidi_find_name_of_device_id(PmDeviceID id, bool input,
+                                     PmError *out_pmerror,
+                                     struct oso **out_name);
+// PortMidi's clock, for opening streams with. Its timestamps are milliseconds
+// on the midi_clock_now_ns() clock, counted from when PortMidi was first used.
+PmTimestamp portmidi_timeproc(void *time_info);
+// Converts a PortMidi timestamp, such as the arrival time of an input event,
+// back to a midi_clock_now_ns() time.
+U64 portmidi_time_of_timestamp(PmTimestamp timestamp);
+#endif
+
+// Returns the current time on the clock used for send times: CLOCK_MONOTONIC,
+// in nanoseconds.
+U64 midi_clock_now_ns(void);
+
+// Sets the time, from midi_clock_now_ns(), that the MIDI sent after this call
+// belongs to. Outputs that can schedule messages stamp them with it instead of
+// with the time they happen to be sent. 0 means 'now', which is the default.
+void midi_mode_set_send_time(Midi_mode *mm, U64 time_ns);
+
+// Messages sent between these two calls are collected, for outputs that can
+// take many at once (PortMidi), and midi_mode_end_batch() writes them all in
+// one go, in the order they were sent. Batches don't nest.
+void midi_mode_begin_batch(Midi_mode *mm);
+void midi_mode_end_batch(Midi_mode *mm);
+
+void send_midi_chan_msg(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                        int type /*0..15*/, int chan /*0.. 15*/,
+                        int byte1 /*0..127*/, int byte2 /*0..127*/);
+void send_midi_byte(Oosc_dev *oosc_dev, Midi_mode *midi_mode, int x);
+void send_midi_note_offs(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                         Susnote const *start, Susnote const *end);
+
+// Counts down the sustained notes by time_elapsed seconds, and sends note-offs
+// for the ones that ran out. Note-offs are stamped with the moment each note
+// ran out, which may be earlier than the current send time.
+void apply_time_to_sustained_notes(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                                   double time_elapsed,
+                                   Susnote_list *susnote_list,
+                                   double *next_note_off_deadline);
+
+// Sends the events from one VM tick, in the order the VM emitted them, as a
+// single batch. Note-ons are added to susnote_list so that
+// apply_time_to_sustained_notes() can turn them off later. Interpolated MIDI
+// CC events set up state in vm, which is advanced with
+// advance_midi_cc_interpolations().
+void send_output_events(Oosc_dev *oosc_dev, Midi_mode *midi_mode, Usz bpm,
+                        Susnote_list *susnote_list, Orca_vm *vm,
+                        Oevent_list const *oevent_list);
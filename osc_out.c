@@ -1,3 +1,6 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for sendmmsg()
+#endif
 #include "osc_out.h"
 #include <arpa/inet.h>
 #include <errno.h>
@@ -6,6 +9,14 @@
 #include <stdio.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#if defined(__linux__)
+#define OOSC_HAVE_SENDMMSG
+#endif
+
+static U32 const Oosc_queued_raw_bit = UINT32_C(1) << 31;
 
 struct Oosc_dev {
   int fd;
@@ -13,6 +24,13 @@ struct Oosc_dev {
   // problems with sockaddr_storage is not worth it.
   struct addrinfo *chosen;
   struct addrinfo *head;
+  // Messages in the open bundle, each one prefixed with its size as a
+  // big-endian 32-bit integer, which is how they're laid out in a bundle.
+  // Raw datagrams sent while the bundle is open are queued along with them,
+  // with Oosc_queued_raw_bit set in their size.
+  char *queue;
+  Usz queue_size, queue_capacity, queue_count;
+  bool is_bundling;
 };
 
 Oosc_udp_create_error oosc_dev_create_udp(Oosc_dev **out_ptr,
@@ -84,6 +102,9 @@ Oosc_udp_create_error oosc_dev_create_udp(Oosc_dev **out_ptr,
   dev->fd = udpfd;
   dev->chosen = chosen;
   dev->head = head;
+  dev->queue = NULL;
+  dev->queue_size = dev->queue_capacity = dev->queue_count = 0;
+  dev->is_bundling = false;
   *out_ptr = dev;
   return Oosc_udp_create_error_ok;
 }
@@ -91,10 +112,26 @@ Oosc_udp_create_error oosc_dev_create_udp(Oosc_dev **out_ptr,
 void oosc_dev_destroy(Oosc_dev *dev) {
   close(dev->fd);
   freeaddrinfo(dev->head);
+  free(dev->queue);
   free(dev);
 }
 
-void oosc_send_datagram(Oosc_dev *dev, char const *data, Usz size) {
+static void oosc_queue_elem(Oosc_dev *dev, char const *data, Usz size,
+                            bool is_raw) {
+  Usz needed = dev->queue_size + sizeof(U32) + size;
+  if (needed > dev->queue_capacity) {
+    Usz cap = orca_round_up_power2(needed < 2048 ? 2048 : needed);
+    dev->queue = realloc(dev->queue, cap);
+    dev->queue_capacity = cap;
+  }
+  U32 size_ne = htonl((U32)size | (is_raw ? Oosc_queued_raw_bit : 0));
+  memcpy(dev->queue + dev->queue_size, &size_ne, sizeof(size_ne));
+  memcpy(dev->queue + dev->queue_size + sizeof(size_ne), data, size);
+  dev->queue_size = needed;
+  ++dev->queue_count;
+}
+
+static void oosc_sendto(Oosc_dev *dev, char const *data, Usz size) {
   ssize_t res = sendto(dev->fd, data, size, 0, dev->chosen->ai_addr,
                        dev->chosen->ai_addrlen);
   (void)res;
@@ -107,6 +144,13 @@ void oosc_send_datagram(Oosc_dev *dev, char const *data, Usz size) {
 #endif
 }
 
+void oosc_send_datagram(Oosc_dev *dev, char const *data, Usz size) {
+  if (dev->is_bundling)
+    oosc_queue_elem(dev, data, size, true);
+  else
+    oosc_sendto(dev, data, size);
+}
+
 static bool oosc_write_strn(char *restrict buffer, Usz buffer_size,
                             Usz *buffer_pos, char const *restrict in_str,
                             Usz in_str_len) {
@@ -164,110 +208,269 @@ void oosc_send_int32s(Oosc_dev *dev, char const *osc_address, I32 const *vals,
     memcpy(buffer + buf_pos, &u_ne, sizeof(u_ne));
     buf_pos += sizeof(u_ne);
   }
-  oosc_send_datagram(dev, buffer, buf_pos);
+  if (dev->is_bundling)
+    oosc_queue_elem(dev, buffer, buf_pos, false);
+  else
+    oosc_sendto(dev, buffer, buf_pos);
+}
+
+void oosc_begin_bundle(Oosc_dev *dev) { dev->is_bundling = true; }
+
+U64 oosc_timetag_from_monotonic_ns(U64 time_ns) {
+  enum { Nsecs_per_sec = 1000000000 };
+  // Seconds from the NTP epoch (1900) to the Unix epoch (1970).
+  U64 const ntp_unix_offset = UINT64_C(2208988800);
+  struct timespec mono, real;
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  U64 mono_ns = (U64)mono.tv_sec * Nsecs_per_sec + (U64)mono.tv_nsec;
+  U64 real_ns = (U64)real.tv_sec * Nsecs_per_sec + (U64)real.tv_nsec;
+  U64 unix_ns = real_ns + time_ns - mono_ns; // wraps correctly if in the past
+  U64 secs = unix_ns / Nsecs_per_sec + ntp_unix_offset;
+  U64 frac = ((unix_ns % Nsecs_per_sec) << 32) / Nsecs_per_sec;
+  return secs << 32 | frac;
+}
+
+// Size of a queued message or raw datagram, including its size prefix.
+static Usz oosc_queued_elem_size(char const *elem, bool *out_is_raw) {
+  U32 size_ne;
+  memcpy(&size_ne, elem, sizeof(size_ne));
+  U32 size = ntohl(size_ne);
+  *out_is_raw = (size & Oosc_queued_raw_bit) != 0;
+  return sizeof(U32) + (size & ~Oosc_queued_raw_bit);
+}
+
+// How many datagrams to hand to the kernel per sendmmsg() call.
+enum { Oosc_send_batch = 16 };
+
+void oosc_flush_bundle(Oosc_dev *dev, U64 timetag) {
+  dev->is_bundling = false;
+  Usz queue_size = dev->queue_size, queue_count = dev->queue_count;
+  dev->queue_size = 0;
+  dev->queue_count = 0;
+  if (queue_count == 0)
+    return;
+  char *queue = dev->queue;
+  if (queue_count == 1 && timetag == Oosc_timetag_immediately) {
+    oosc_sendto(dev, queue + sizeof(U32), queue_size - sizeof(U32));
+    return;
+  }
+  char header[16] = "#bundle";
+  U32 tt_hi = htonl((U32)(timetag >> 32)), tt_lo = htonl((U32)timetag);
+  memcpy(header + 8, &tt_hi, sizeof(tt_hi));
+  memcpy(header + 12, &tt_lo, sizeof(tt_lo));
+  // Each datagram is either the header followed by a run of whole messages
+  // straight out of the queue, or a raw datagram on its own. Runs are broken
+  // at raw datagrams, so that everything goes out in the order it was queued.
+  struct iovec iovs[Oosc_send_batch][2];
+  Usz batch_count = 0;
+#ifdef OOSC_HAVE_SENDMMSG
+  struct mmsghdr msgs[Oosc_send_batch];
+#endif
+  Usz pos = 0;
+  while (pos < queue_size) {
+    Usz start = pos;
+    bool is_raw;
+    pos += oosc_queued_elem_size(queue + pos, &is_raw);
+    struct iovec *iov = iovs[batch_count];
+    if (is_raw) {
+      iov[0].iov_base = queue + start + sizeof(U32);
+      iov[0].iov_len = pos - start - sizeof(U32);
+    } else {
+      while (pos < queue_size) {
+        bool next_is_raw;
+        Usz next = oosc_queued_elem_size(queue + pos, &next_is_raw);
+        if (next_is_raw ||
+            sizeof(header) + pos - start + next > Oosc_max_bundle_size)
+          break;
+        pos += next;
+      }
+      iov[0].iov_base = header;
+      iov[0].iov_len = sizeof(header);
+      iov[1].iov_base = queue + start;
+      iov[1].iov_len = pos - start;
+    }
+#ifdef OOSC_HAVE_SENDMMSG
+    struct msghdr *mh = &msgs[batch_count].msg_hdr;
+    memset(mh, 0, sizeof(*mh));
+    mh->msg_name = dev->chosen->ai_addr;
+    mh->msg_namelen = dev->chosen->ai_addrlen;
+    mh->msg_iov = iov;
+    mh->msg_iovlen = is_raw ? 1 : 2;
+#endif
+    ++batch_count;
+    if (batch_count < Oosc_send_batch && pos < queue_size)
+      continue;
+#ifdef OOSC_HAVE_SENDMMSG
+    // sendmmsg() stops at the first datagram that fails, and returns how many
+    // went before it, or -1 if it was the first. Skip the failed one, like
+    // the sendmsg() loop below does, and go on with the rest.
+    Usz sent = 0;
+    while (sent < batch_count) {
+      int res = sendmmsg(dev->fd, msgs + sent, (unsigned)(batch_count - sent),
+                         0);
+      if (res > 0)
+        sent += (Usz)res;
+      else if (!(res < 0 && errno == EINTR))
+        ++sent;
+    }
+#else
+    for (Usz i = 0; i < batch_count; ++i) {
+      struct msghdr mh = {0};
+      mh.msg_name = dev->chosen->ai_addr;
+      mh.msg_namelen = dev->chosen->ai_addrlen;
+      mh.msg_iov = iovs[i];
+      mh.msg_iovlen = iovs[i][0].iov_base == header ? 2 : 1;
+      ssize_t res = sendmsg(dev->fd, &mh, 0);
+      (void)res;
+    }
+#endif
+    batch_count = 0;
+  }
+}
+
+enum { Susnote_no_entry = 0xFFFF };
+
+static Usz susnote_index_of(U16 chan_note) {
+  return (Usz)(chan_note >> 8) * 128 + (chan_note & 127);
 }
 
 void susnote_list_init(Susnote_list *sl) {
-  sl->buffer = NULL;
+  sl->heap = NULL;
   sl->count = 0;
   sl->capacity = 0;
+  sl->time = 0.0;
+  sl->removed = NULL;
+  sl->removed_count = 0;
+  sl->removed_capacity = 0;
+  memset(sl->index, 0xFF, sizeof sl->index);
 }
 
-void susnote_list_deinit(Susnote_list *sl) { free(sl->buffer); }
+void susnote_list_deinit(Susnote_list *sl) {
+  free(sl->heap);
+  free(sl->removed);
+}
 
-void susnote_list_clear(Susnote_list *sl) { sl->count = 0; }
+void susnote_list_clear(Susnote_list *sl) {
+  for (Usz i = 0, n = sl->count; i < n; ++i)
+    sl->index[susnote_index_of(sl->heap[i].chan_note)] = Susnote_no_entry;
+  sl->count = 0;
+  sl->removed_count = 0;
+}
 
-void susnote_list_add_notes(Susnote_list *sl, Susnote const *restrict notes,
-                            Usz added_count, Usz *restrict start_removed,
-                            Usz *restrict end_removed) {
-  Susnote *buffer = sl->buffer;
+static void susnote_heap_set(Susnote_list *sl, Usz i, Susnote_entry e) {
+  sl->heap[i] = e;
+  sl->index[susnote_index_of(e.chan_note)] = (U16)i;
+}
+
+static void susnote_heap_sift_up(Susnote_list *sl, Usz i) {
+  Susnote_entry e = sl->heap[i];
+  while (i > 0) {
+    Usz parent = (i - 1) / 2;
+    if (sl->heap[parent].expiry <= e.expiry)
+      break;
+    susnote_heap_set(sl, i, sl->heap[parent]);
+    i = parent;
+  }
+  susnote_heap_set(sl, i, e);
+}
+
+static void susnote_heap_sift_down(Susnote_list *sl, Usz i) {
+  Susnote_entry e = sl->heap[i];
   Usz count = sl->count;
-  Usz cap = sl->capacity;
-  Usz rem = count + added_count;
-  Usz needed_cap = rem + added_count;
-  if (cap < needed_cap) {
-    cap = needed_cap < 16 ? 16 : orca_round_up_power2(needed_cap);
-    buffer = realloc(buffer, cap * sizeof(Susnote));
-    sl->capacity = cap;
-    sl->buffer = buffer;
+  for (;;) {
+    Usz child = i * 2 + 1;
+    if (child >= count)
+      break;
+    if (child + 1 < count &&
+        sl->heap[child + 1].expiry < sl->heap[child].expiry)
+      ++child;
+    if (e.expiry <= sl->heap[child].expiry)
+      break;
+    susnote_heap_set(sl, i, sl->heap[child]);
+    i = child;
   }
-  *start_removed = rem;
-  Usz i_in = 0;
-  for (; i_in < added_count; ++i_in) {
-    Susnote this_in = notes[i_in];
-    for (Usz i_old = 0; i_old < count; ++i_old) {
-      Susnote this_old = buffer[i_old];
-      if (this_old.chan_note == this_in.chan_note) {
-        buffer[i_old] = this_in;
-        buffer[rem] = this_old;
-        ++rem;
-        goto next_in;
-      }
-    }
-    buffer[count] = this_in;
-    ++count;
-  next_in:;
+  susnote_heap_set(sl, i, e);
+}
+
+// Takes the entry at heap position i out of the list and appends it to
+// sl->removed.
+static void susnote_list_take(Susnote_list *sl, Usz i) {
+  Susnote_entry e = sl->heap[i];
+  if (sl->removed_count == sl->removed_capacity) {
+    Usz cap = sl->removed_capacity ? sl->removed_capacity * 2 : 16;
+    sl->removed = realloc(sl->removed, cap * sizeof(Susnote));
+    sl->removed_capacity = cap;
   }
-  sl->count = count;
-  *end_removed = rem;
+  sl->removed[sl->removed_count++] =
+      (Susnote){.remaining = (float)(e.expiry - sl->time),
+                .chan_note = e.chan_note};
+  sl->index[susnote_index_of(e.chan_note)] = Susnote_no_entry;
+  Usz last = --sl->count;
+  if (i == last)
+    return;
+  susnote_heap_set(sl, i, sl->heap[last]);
+  if (i > 0 && sl->heap[(i - 1) / 2].expiry > sl->heap[i].expiry)
+    susnote_heap_sift_up(sl, i);
+  else
+    susnote_heap_sift_down(sl, i);
 }
 
-void susnote_list_advance_time(Susnote_list *sl, double delta_time,
-                               Usz *restrict start_removed,
-                               Usz *restrict end_removed,
-                               double *soonest_deadline) {
-  Susnote *restrict buffer = sl->buffer;
-  Usz count = sl->count;
-  *end_removed = count;
-  float delta_float = (float)delta_time;
-  float soonest = 1.0f;
-  for (Usz i = 0; i < count;) {
-    Susnote sn = buffer[i];
-    sn.remaining -= delta_float;
-    if (sn.remaining > 0.001) {
-      if (sn.remaining < soonest)
-        soonest = sn.remaining;
-      buffer[i].remaining = sn.remaining;
-      ++i;
-    } else {
-      --count;
-      buffer[i] = buffer[count];
-      buffer[count] = sn;
+Usz susnote_list_add_notes(Susnote_list *sl, Susnote const *restrict notes,
+                           Usz added_count) {
+  sl->removed_count = 0;
+  for (Usz i = 0; i < added_count; ++i) {
+    Susnote_entry e = {.expiry = sl->time + (double)notes[i].remaining,
+                       .chan_note = notes[i].chan_note};
+    Usz slot = sl->index[susnote_index_of(e.chan_note)];
+    if (slot != Susnote_no_entry)
+      susnote_list_take(sl, slot);
+    if (sl->count == sl->capacity) {
+      Usz cap = sl->capacity ? sl->capacity * 2 : 16;
+      sl->heap = realloc(sl->heap, cap * sizeof(Susnote_entry));
+      sl->capacity = cap;
     }
+    Usz pos = sl->count++;
+    sl->heap[pos] = e;
+    susnote_heap_sift_up(sl, pos);
   }
-  *start_removed = count;
-  *soonest_deadline = (double)soonest;
-  sl->count = count;
+  return sl->removed_count;
 }
 
-void susnote_list_remove_by_chan_mask(Susnote_list *sl, Usz chan_mask,
-                                      Usz *restrict start_removed,
-                                      Usz *restrict end_removed) {
-  Susnote *restrict buffer = sl->buffer;
-  Usz count = sl->count;
-  *end_removed = count;
-  for (Usz i = 0; i < count;) {
-    Susnote sn = buffer[i];
-    Usz chan = sn.chan_note >> 8;
-    if (chan_mask & 1u << chan) {
-      --count;
-      buffer[i] = buffer[count];
-      buffer[count] = sn;
-    } else {
-      ++i;
+Usz susnote_list_advance_time(Susnote_list *sl, double delta_time,
+                              double *soonest_deadline) {
+  sl->removed_count = 0;
+  sl->time += delta_time;
+  while (sl->count > 0 && sl->heap[0].expiry - sl->time <= 0.001)
+    susnote_list_take(sl, 0);
+  *soonest_deadline = susnote_list_soonest_deadline(sl);
+  return sl->removed_count;
+}
+
+Usz susnote_list_remove_by_chan_mask(Susnote_list *sl, Usz chan_mask) {
+  sl->removed_count = 0;
+  for (Usz chan = 0; chan < 16; ++chan) {
+    if (!(chan_mask & (Usz)1 << chan))
+      continue;
+    U16 const *chan_index = sl->index + chan * 128;
+    for (Usz note = 0; note < 128; ++note) {
+      if (chan_index[note] != Susnote_no_entry)
+        susnote_list_take(sl, chan_index[note]);
     }
   }
-  *start_removed = count;
-  sl->count = count;
+  return sl->removed_count;
+}
+
+Usz susnote_list_remove_all(Susnote_list *sl) {
+  sl->removed_count = 0;
+  while (sl->count > 0)
+    susnote_list_take(sl, sl->count - 1);
+  return sl->removed_count;
 }
 
 double susnote_list_soonest_deadline(Susnote_list const *sl) {
-  float soonest = 1.0f;
-  Susnote const *buffer = sl->buffer;
-  for (Usz i = 0, n = sl->count; i < n; ++i) {
-    float rem = buffer[i].remaining;
-    if (rem < soonest)
-      soonest = rem;
-  }
-  return (double)soonest;
+  if (sl->count == 0)
+    return 1.0;
+  double soonest = sl->heap[0].expiry - sl->time;
+  return soonest < 1.0 ? soonest : 1.0;
 }
@@ -14,14 +14,41 @@ Oosc_udp_create_error oosc_dev_create_udp(Oosc_dev **out_ptr,
                                           char const *dest_port);
 void oosc_dev_destroy(Oosc_dev *dev);
 
-// Send a raw UDP datagram.
+// Send a raw UDP datagram. Raw datagrams aren't OSC messages, so they can't
+// go in a bundle. One sent while a bundle is open is queued with the bundle's
+// messages, and oosc_flush_bundle() sends it on its own, in order between the
+// messages queued before and after it. It has no time tag, though, so it's
+// acted on as soon as it arrives.
 void oosc_send_datagram(Oosc_dev *dev, char const *data, Usz size);
 
 // Send a list/array of 32-bit integers in OSC format to the specified "osc
-// address" (a path like /foo) as a UDP datagram.
+// address" (a path like /foo) as a UDP datagram, or add it to the open bundle.
 void oosc_send_int32s(Oosc_dev *dev, char const *osc_address, I32 const *vals,
                       Usz count);
 
+// OSC time tag meaning 'as soon as it arrives'.
+enum { Oosc_timetag_immediately = 1 };
+
+// Converts a time on CLOCK_MONOTONIC, in nanoseconds, to an OSC time tag,
+// which is NTP time: seconds since 1900 in the upper 32 bits and the fraction
+// of a second in the lower 32. Goes through the wall clock, so the receiver
+// only needs its wall clock to agree with ours.
+U64 oosc_timetag_from_monotonic_ns(U64 time_ns);
+
+// Largest datagram a bundle is packed into, so that it fits in one Ethernet
+// frame. A single message that's larger than this is still sent on its own.
+enum { Oosc_max_bundle_size = 1472 };
+
+// Between these, OSC messages are queued on the device instead of being sent.
+// oosc_flush_bundle() then sends them as an OSC bundle with the given time
+// tag, split over as few datagrams as fit within Oosc_max_bundle_size, and
+// with a single sendmmsg() call where it's available. A lone message with an
+// immediate time tag is sent as a plain message. Bundles don't nest.
+// Everything queued goes out in the order it was queued, including raw
+// datagrams.
+void oosc_begin_bundle(Oosc_dev *dev);
+void oosc_flush_bundle(Oosc_dev *dev, U64 timetag);
+
 // Susnote is for handling MIDI note sustains -- each MIDI on event should be
 // matched with a MIDI note-off event. The duration/sustain length of a MIDI
 // note is specified when it is first triggered, so the orca VM itself is not
@@ -32,25 +59,45 @@ typedef struct {
   U16 chan_note;
 } Susnote;
 
+// The held notes are kept in a min-heap ordered by when they run out, on the
+// list's own clock, and index maps each channel and note number to its place
+// in the heap. Adding, retriggering and removing a note are O(log n), and
+// finding the next one to run out is O(1).
+typedef struct {
+  double expiry;
+  U16 chan_note;
+} Susnote_entry;
+
+enum { Susnote_index_size = 16 * 128 };
+
 typedef struct {
-  Susnote *buffer;
+  Susnote_entry *heap;
   Usz count, capacity;
+  double time;
+  // The notes taken out of the list by the last call that removes any, with
+  // their remaining time. Negative means they ran out that long ago.
+  Susnote *removed;
+  Usz removed_count, removed_capacity;
+  U16 index[Susnote_index_size];
 } Susnote_list;
 
 void susnote_list_init(Susnote_list *sl);
 void susnote_list_deinit(Susnote_list *sl);
 void susnote_list_clear(Susnote_list *sl);
-void susnote_list_add_notes(Susnote_list *sl, Susnote const *restrict notes,
-                            Usz count, Usz *restrict start_removed,
-                            Usz *restrict end_removed);
-void susnote_list_advance_time(
-    Susnote_list *sl, double delta_time, Usz *restrict start_removed,
-    Usz *restrict end_removed,
+// Each of these puts the notes it takes out of the list into sl->removed, and
+// returns how many there were.
+//
+// A note that's added while the same note on the same channel is still held
+// replaces it, and the old one is removed.
+Usz susnote_list_add_notes(Susnote_list *sl, Susnote const *notes, Usz count);
+// Removes the notes that run out within delta_time seconds, in the order they
+// ran out.
+Usz susnote_list_advance_time(
+    Susnote_list *sl, double delta_time,
     // 1.0 if no notes remain or none are shorter than 1.0
     double *soonest_deadline);
-void susnote_list_remove_by_chan_mask(Susnote_list *sl, Usz chan_mask,
-                                      Usz *restrict start_removed,
-                                      Usz *restrict end_removed);
+Usz susnote_list_remove_by_chan_mask(Susnote_list *sl, Usz chan_mask);
+Usz susnote_list_remove_all(Susnote_list *sl);
 
 // Returns 1.0 if no notes remain or none are shorter than 1.0
 double susnote_list_soonest_deadline(Susnote_list const *sl);
@@ -0,0 +1,576 @@
+#include "base.h"
+#include "field.h"
+#include "gbuffer.h"
+#include "midi_out.h"
+#include "osc_out.h"
+#include "sim.h"
+#include "vmio.h"
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+// Headless server. Loads any number of .orca files and ticks all of them in
+// lockstep from one clock, without a UI. The grids are run in parallel on a
+// pool of worker threads, and then their output events are sent from the main
+// thread in the order the files were given on the command line, so that the
+// output for a tick doesn't depend on which thread finished first.
+
+static ORCA_NOINLINE void usage(void) { // clang-format off
+fprintf(stderr,
+"Usage: orca-server [options] infile...\n\n"
+"Options:\n"
+"    --bpm <number>     Set the tempo (beats per minute).\n"
+"                       Default: 120\n"
+"    --seed <number>    Set the seed for the random function.\n"
+"                       Default: 1\n"
+"    -t <number>        Stop after this many ticks.\n"
+"                       Must be 0 or a positive integer. 0 means run forever.\n"
+"                       Default: 0\n"
+"    -j or --threads <number>\n"
+"                       Number of worker threads used to run the grids.\n"
+"                       Default: the number of online CPUs, but no more than\n"
+"                       the number of files.\n"
+"    -h or --help       Print this message and exit.\n"
+"\n"
+"OSC/MIDI options:\n"
+"    --osc-server <address>\n"
+"        Hostname or IP address to send OSC messages to.\n"
+"        Default: loopback (this machine)\n"
+"\n"
+"    --osc-port <number or service name>\n"
+"        UDP port (or service name) to send OSC messages to.\n"
+"        This option must be set for OSC output to be enabled.\n"
+"        Default: none\n"
+"\n"
+"    --osc-midi-bidule <path>\n"
+"        Set MIDI to be sent via OSC formatted for Plogue Bidule.\n"
+"        The path argument is the path of the Plogue OSC MIDI device.\n"
+"        Example: /OSC_MIDI_0/MIDI\n"
+"\n"
+"    --osc-lookahead <ms>\n"
+"        Time-tag each tick's OSC bundle with when the tick was due plus\n"
+"        this many milliseconds, so that a receiver like SuperCollider can\n"
+"        schedule it exactly. The receiver's clock has to agree with this\n"
+"        machine's. Without this option, bundles are handled on arrival.\n"
+"\n"
+"    --cc-rate <hz>\n"
+"        How many times per second to send the MIDI CC ramps started by\n"
+"        the ! operator. Only values that changed are sent. 0 moves them\n"
+"        only on each tick.\n"
+"        Default: 1000\n"
+#ifdef FEAT_PORTMIDI
+"\n"
+"    --portmidi-output-device <name>\n"
+"        Send MIDI to the named PortMidi output device.\n"
+"\n"
+"    --midi-latency <ms>\n"
+"        Schedule PortMidi output this many milliseconds ahead of when\n"
+"        it's due, so that timing jitter comes from the MIDI driver\n"
+"        instead of from the server. 0 sends everything immediately.\n"
+"        Default: 1\n"
+#endif
+);} // clang-format on
+
+typedef struct {
+  char const *path;
+  Field field;
+  Mbuf_reusable mbuf_r;
+  Oevent_list oevent_list;
+  Orca_vm vm;
+} Server_grid;
+
+// Worker threads wait for the generation counter to change, then claim grids
+// one at a time until none are left. The last thread to finish a grid wakes
+// the main thread back up.
+typedef struct {
+  Server_grid *grids;
+  Usz grid_count;
+  Usz tick_num;
+  Usz random_seed;
+  pthread_mutex_t mutex;
+  pthread_cond_t start_cond;
+  pthread_cond_t done_cond;
+  U64 generation;
+  Usz next_grid;
+  Usz pending;
+  bool quit;
+} Server_pool;
+
+static void server_grid_run(Server_grid *g, Usz tick_num, Usz random_seed) {
+  Usz height = g->field.height, width = g->field.width;
+  mbuffer_clear(g->mbuf_r.buffer, height, width);
+  oevent_list_clear(&g->oevent_list);
+  orca_vm_run(&g->vm, g->field.buffer, g->mbuf_r.buffer, height, width,
+              tick_num, &g->oevent_list, random_seed);
+}
+
+static void *server_worker(void *arg) {
+  Server_pool *p = arg;
+  U64 seen = 0;
+  pthread_mutex_lock(&p->mutex);
+  for (;;) {
+    while (!p->quit && p->generation == seen)
+      pthread_cond_wait(&p->start_cond, &p->mutex);
+    if (p->quit)
+      break;
+    seen = p->generation;
+    while (p->next_grid < p->grid_count) {
+      Usz i = p->next_grid++;
+      Usz tick_num = p->tick_num, random_seed = p->random_seed;
+      pthread_mutex_unlock(&p->mutex);
+      server_grid_run(&p->grids[i], tick_num, random_seed);
+      pthread_mutex_lock(&p->mutex);
+      if (--p->pending == 0)
+        pthread_cond_signal(&p->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return NULL;
+}
+
+// Runs every grid for one tick and returns when all of them are done.
+static void server_pool_run_tick(Server_pool *p, Usz thread_count) {
+  if (thread_count <= 1) {
+    for (Usz i = 0; i < p->grid_count; ++i)
+      server_grid_run(&p->grids[i], p->tick_num, p->random_seed);
+    return;
+  }
+  pthread_mutex_lock(&p->mutex);
+  p->next_grid = 0;
+  p->pending = p->grid_count;
+  ++p->generation;
+  pthread_cond_broadcast(&p->start_cond);
+  while (p->pending > 0)
+    pthread_cond_wait(&p->done_cond, &p->mutex);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+static volatile sig_atomic_t server_should_quit = 0;
+
+static void server_handle_signal(int sig) {
+  (void)sig;
+  server_should_quit = 1;
+}
+
+static void sleep_secs(double secs) {
+  if (secs <= 0.0)
+    return;
+  struct timespec ts;
+  ts.tv_sec = (time_t)secs;
+  ts.tv_nsec = (long)((secs - (double)ts.tv_sec) * 1e9);
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR && !server_should_quit) {
+  }
+}
+
+// osc_lookahead is in milliseconds. Negative means don't time-tag bundles.
+static U64 server_osc_timetag(int osc_lookahead, U64 time) {
+  if (osc_lookahead < 0)
+    return Oosc_timetag_immediately;
+  return oosc_timetag_from_monotonic_ns(time + (U64)osc_lookahead *
+                                                   UINT64_C(1000000));
+}
+
+static bool server_has_cc_ramps(Server_grid const *grids, Usz grid_count) {
+  for (Usz i = 0; i < grid_count; ++i) {
+    if (has_midi_cc_interpolations(&grids[i].vm))
+      return true;
+  }
+  return false;
+}
+
+// Moves every grid's MIDI CC ramps along to time, which is from
+// midi_clock_now_ns(), and sends the values that changed.
+static void server_advance_cc_ramps(Server_grid *grids, Usz grid_count,
+                                    Oosc_dev *oosc_dev, Midi_mode *midi_mode,
+                                    int bpm, Susnote_list *susnote_list,
+                                    Oevent_list *scratch, U64 *ramp_time,
+                                    U64 time) {
+  double secs = time > *ramp_time ? (double)(time - *ramp_time) / 1e9 : 0.0;
+  *ramp_time = time;
+  for (Usz i = 0; i < grid_count; ++i) {
+    Orca_vm *vm = &grids[i].vm;
+    if (!has_midi_cc_interpolations(vm))
+      continue;
+    oevent_list_clear(scratch);
+    advance_midi_cc_interpolations(vm, secs, scratch);
+    if (scratch->count > 0)
+      send_output_events(oosc_dev, midi_mode, (Usz)bpm, susnote_list, vm,
+                         scratch);
+  }
+}
+
+enum {
+  Argopt_bpm = UCHAR_MAX + 1,
+  Argopt_seed,
+  Argopt_cc_rate,
+  Argopt_osc_lookahead,
+  Argopt_osc_server,
+  Argopt_osc_port,
+  Argopt_osc_midi_bidule,
+#ifdef FEAT_PORTMIDI
+  Argopt_portmidi_output_device,
+  Argopt_midi_latency,
+#endif
+};
+
+int main(int argc, char **argv) {
+  static struct option server_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"threads", required_argument, 0, 'j'},
+      {"bpm", required_argument, 0, Argopt_bpm},
+      {"seed", required_argument, 0, Argopt_seed},
+      {"cc-rate", required_argument, 0, Argopt_cc_rate},
+      {"osc-lookahead", required_argument, 0, Argopt_osc_lookahead},
+      {"osc-server", required_argument, 0, Argopt_osc_server},
+      {"osc-port", required_argument, 0, Argopt_osc_port},
+      {"osc-midi-bidule", required_argument, 0, Argopt_osc_midi_bidule},
+#ifdef FEAT_PORTMIDI
+      {"portmidi-output-device", required_argument, 0,
+       Argopt_portmidi_output_device},
+      {"midi-latency", required_argument, 0, Argopt_midi_latency},
+#endif
+      {NULL, 0, NULL, 0}};
+
+  int ticks = 0;
+  int threads = 0;
+  int bpm = 120;
+  int seed = 1;
+  int cc_rate = 1000;
+  int osc_lookahead = -1;
+  char const *osc_hostname = NULL;
+  char const *osc_port = NULL;
+  char const *osc_midi_bidule_path = NULL;
+#ifdef FEAT_PORTMIDI
+  char const *portmidi_output_device = NULL;
+  int midi_latency = Portmidi_default_latency;
+#endif
+
+  for (;;) {
+    int c = getopt_long(argc, argv, "t:j:h", server_options, NULL);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 't':
+      ticks = atoi(optarg);
+      if (ticks < 0 || (ticks == 0 && strcmp(optarg, "0"))) {
+        fprintf(stderr,
+                "Bad timestep argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if (threads <= 0) {
+        fprintf(stderr,
+                "Bad threads argument %s.\n"
+                "Must be a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case Argopt_bpm:
+      bpm = atoi(optarg);
+      if (bpm < 1) {
+        fprintf(stderr,
+                "Bad bpm argument %s.\n"
+                "Must be a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case Argopt_seed:
+      seed = atoi(optarg);
+      if (seed < 1 && strcmp(optarg, "0")) {
+        fprintf(stderr,
+                "Bad seed argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case Argopt_cc_rate:
+      cc_rate = atoi(optarg);
+      if (cc_rate < 0 || (cc_rate == 0 && strcmp(optarg, "0"))) {
+        fprintf(stderr,
+                "Bad cc-rate argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case Argopt_osc_lookahead:
+      osc_lookahead = atoi(optarg);
+      if (osc_lookahead < 0 || (osc_lookahead == 0 && strcmp(optarg, "0"))) {
+        fprintf(stderr,
+                "Bad osc-lookahead argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+    case Argopt_osc_server:
+      osc_hostname = optarg;
+      break;
+    case Argopt_osc_port:
+      osc_port = optarg;
+      break;
+    case Argopt_osc_midi_bidule:
+      osc_midi_bidule_path = optarg;
+      break;
+#ifdef FEAT_PORTMIDI
+    case Argopt_portmidi_output_device:
+      portmidi_output_device = optarg;
+      break;
+    case Argopt_midi_latency:
+      midi_latency = atoi(optarg);
+      if (midi_latency < 0 || (midi_latency == 0 && strcmp(optarg, "0"))) {
+        fprintf(stderr,
+                "Bad midi-latency argument %s.\n"
+                "Must be 0 or a positive integer.\n",
+                optarg);
+        return 1;
+      }
+      break;
+#endif
+    case 'h':
+      usage();
+      return 0;
+    case '?':
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "No input files.\n");
+    usage();
+    return 1;
+  }
+  if (osc_hostname && !osc_port) {
+    fprintf(stderr, "An OSC server address was specified, but no OSC port "
+                    "was specified.\n"
+                    "OSC output is not possible without specifying an OSC "
+                    "port.\n");
+    return 1;
+  }
+  if (osc_midi_bidule_path && !osc_port) {
+    fprintf(stderr, "An OSC path for Plogue Bidule MIDI was specified, but "
+                    "no OSC port was specified.\n"
+                    "OSC output is not possible without specifying an OSC "
+                    "port.\n");
+    return 1;
+  }
+
+  Usz grid_count = (Usz)(argc - optind);
+  Server_grid *grids = calloc(grid_count, sizeof(Server_grid));
+  int exit_code = 0;
+  Usz loaded = 0;
+  for (; loaded < grid_count; ++loaded) {
+    Server_grid *g = &grids[loaded];
+    g->path = argv[optind + (int)loaded];
+    field_init(&g->field);
+    Field_load_error fle = field_load_file(g->path, &g->field);
+    if (fle != Field_load_error_ok) {
+      fprintf(stderr, "File load error: %s: %s.\n", g->path,
+              field_load_error_string(fle));
+      field_deinit(&g->field);
+      exit_code = 1;
+      goto done_grids;
+    }
+    mbuf_reusable_init(&g->mbuf_r);
+    mbuf_reusable_ensure_size(&g->mbuf_r, g->field.height, g->field.width);
+    oevent_list_init(&g->oevent_list);
+    orca_vm_init(&g->vm);
+  }
+
+  Oosc_dev *oosc_dev = NULL;
+  if (osc_port) {
+    Oosc_udp_create_error err =
+        oosc_dev_create_udp(&oosc_dev, osc_hostname, osc_port);
+    if (err) {
+      fprintf(stderr, "Failed to set up OSC networking.\n");
+      exit_code = 1;
+      goto done_grids;
+    }
+  }
+  Midi_mode midi_mode;
+  midi_mode_init_null(&midi_mode);
+  if (osc_midi_bidule_path) {
+    midi_mode_init_osc_bidule(&midi_mode, osc_midi_bidule_path);
+  }
+#ifdef FEAT_PORTMIDI
+  else if (portmidi_output_device) {
+    PmError pmerr;
+    PmDeviceID devid;
+    if (!portmidi_find_device_id_by_name(portmidi_output_device,
+                                         strlen(portmidi_output_device),
+                                         false, &pmerr, &devid)) {
+      fprintf(stderr, "PortMidi output device not found: %s\n",
+              portmidi_output_device);
+      exit_code = 1;
+      goto done_midi;
+    }
+    pmerr = midi_mode_init_portmidi(&midi_mode, devid, midi_latency);
+    if (pmerr) {
+      fprintf(stderr, "Failed to open PortMidi output device: %s\n",
+              Pm_GetErrorText(pmerr));
+      exit_code = 1;
+      goto done_midi;
+    }
+  }
+#endif
+
+  Usz thread_count = (Usz)threads;
+  if (thread_count == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = ncpu > 0 ? (Usz)ncpu : 1;
+  }
+  if (thread_count > grid_count)
+    thread_count = grid_count;
+
+  Server_pool pool;
+  pool.grids = grids;
+  pool.grid_count = grid_count;
+  pool.tick_num = 0;
+  pool.random_seed = (Usz)seed;
+  pthread_mutex_init(&pool.mutex, NULL);
+  pthread_cond_init(&pool.start_cond, NULL);
+  pthread_cond_init(&pool.done_cond, NULL);
+  pool.generation = 0;
+  pool.next_grid = 0;
+  pool.pending = 0;
+  pool.quit = false;
+  pthread_t *workers = NULL;
+  Usz worker_count = 0;
+  if (thread_count > 1) {
+    workers = malloc(thread_count * sizeof(pthread_t));
+    for (; worker_count < thread_count; ++worker_count) {
+      if (pthread_create(&workers[worker_count], NULL, server_worker, &pool))
+        break;
+    }
+    if (worker_count == 0)
+      thread_count = 1;
+  }
+
+  struct sigaction sa = {0};
+  sa.sa_handler = server_handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  Susnote_list susnote_list;
+  susnote_list_init(&susnote_list);
+  Oevent_list scratch_oevent_list;
+  oevent_list_init(&scratch_oevent_list);
+  double time_to_next_note_off = 1.0;
+  double secs_span = 60.0 / (double)bpm / 4.0;
+  U64 cc_ramp_period =
+      cc_rate > 0 ? UINT64_C(1000000000) / (U64)cc_rate : 0;
+
+  U64 start = midi_clock_now_ns();
+  U64 cc_ramp_time = start;
+  for (Usz tick_num = 0; !server_should_quit; ++tick_num) {
+    if (ticks > 0 && tick_num >= (Usz)ticks)
+      break;
+    // Deadlines are measured from the start, so that lateness on one tick
+    // doesn't push back all of the ticks after it.
+    U64 tick_time = start + (U64)(secs_span * 1e9 * (double)tick_num);
+    // Everything sent over OSC for this tick, from every grid, goes out as
+    // one bundle.
+    if (oosc_dev)
+      oosc_begin_bundle(oosc_dev);
+    midi_mode_set_send_time(&midi_mode, tick_time);
+    server_advance_cc_ramps(grids, grid_count, oosc_dev, &midi_mode, bpm,
+                            &susnote_list, &scratch_oevent_list,
+                            &cc_ramp_time, tick_time);
+    apply_time_to_sustained_notes(oosc_dev, &midi_mode, secs_span,
+                                  &susnote_list, &time_to_next_note_off);
+    pool.tick_num = tick_num;
+    server_pool_run_tick(&pool, thread_count);
+    // Merge in grid order, so the output doesn't depend on thread timing.
+    for (Usz i = 0; i < grid_count; ++i) {
+      Server_grid *g = &grids[i];
+      if (g->oevent_list.count == 0)
+        continue;
+      send_output_events(oosc_dev, &midi_mode, (Usz)bpm, &susnote_list,
+                         &g->vm, &g->oevent_list);
+    }
+    // Sends the ramps with an interpolation rate of 0 right away.
+    server_advance_cc_ramps(grids, grid_count, oosc_dev, &midi_mode, bpm,
+                            &susnote_list, &scratch_oevent_list,
+                            &cc_ramp_time, tick_time);
+    if (oosc_dev)
+      oosc_flush_bundle(oosc_dev, server_osc_timetag(osc_lookahead, tick_time));
+    U64 deadline = start + (U64)(secs_span * 1e9 * (double)(tick_num + 1));
+    // Between ticks, wake up to move the MIDI CC ramps along.
+    for (;;) {
+      U64 now = midi_clock_now_ns();
+      if (now >= deadline || server_should_quit)
+        break;
+      U64 wake = deadline;
+      if (cc_ramp_period && server_has_cc_ramps(grids, grid_count)) {
+        U64 next_cc = cc_ramp_time + cc_ramp_period;
+        if (now >= next_cc) {
+          if (oosc_dev)
+            oosc_begin_bundle(oosc_dev);
+          midi_mode_set_send_time(&midi_mode, now);
+          server_advance_cc_ramps(grids, grid_count, oosc_dev, &midi_mode, bpm,
+                                  &susnote_list, &scratch_oevent_list,
+                                  &cc_ramp_time, now);
+          if (oosc_dev)
+            oosc_flush_bundle(oosc_dev, server_osc_timetag(osc_lookahead, now));
+          continue;
+        }
+        if (next_cc < wake)
+          wake = next_cc;
+      }
+      sleep_secs((double)(wake - now) / 1e9);
+    }
+  }
+
+  midi_mode_set_send_time(&midi_mode, 0);
+  Usz removed = susnote_list_remove_all(&susnote_list);
+  midi_mode_begin_batch(&midi_mode);
+  send_midi_note_offs(oosc_dev, &midi_mode, susnote_list.removed,
+                      susnote_list.removed + removed);
+  midi_mode_end_batch(&midi_mode);
+
+  if (worker_count > 0) {
+    pthread_mutex_lock(&pool.mutex);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.start_cond);
+    pthread_mutex_unlock(&pool.mutex);
+    for (Usz i = 0; i < worker_count; ++i)
+      pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  pthread_cond_destroy(&pool.done_cond);
+  pthread_cond_destroy(&pool.start_cond);
+  pthread_mutex_destroy(&pool.mutex);
+  susnote_list_deinit(&susnote_list);
+  oevent_list_deinit(&scratch_oevent_list);
+
+#ifdef FEAT_PORTMIDI
+done_midi:
+#endif
+  midi_mode_deinit(&midi_mode);
+#ifdef FEAT_PORTMIDI
+  portmidi_terminate_if_necessary();
+#endif
+  if (oosc_dev)
+    oosc_dev_destroy(oosc_dev);
+done_grids:
+  for (Usz i = 0; i < loaded; ++i) {
+    Server_grid *g = &grids[i];
+    field_deinit(&g->field);
+    mbuf_reusable_deinit(&g->mbuf_r);
+    oevent_list_deinit(&g->oevent_list);
+    orca_vm_deinit(&g->vm);
+  }
+  free(grids);
+  return exit_code;
+}
@@ -6,8 +6,18 @@
 #include <string.h>
 #include <time.h>
 
-// stored unique random value
-Usz last_random_unique = UINT_MAX;
+#if defined(__GNUC__) || defined(__clang__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ORCA_SIM_SCAN_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ORCA_SIM_SCAN_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ORCA_SIM_SCAN_NEON
+#endif
+#endif
 
 // Note Sequence
 static char note_sequence[] = "CcDdEFfGgAaB";
@@ -93,20 +103,11 @@ typedef struct {
   Glyph *vars_slots;
   Oevent_list *oevent_list;
   Usz random_seed;
+  Orca_vm *vm;
+  Oper_index *oper_index; // null when running without an index
+  bool mark_only;         // See PORTS_DONE
 } Oper_extra_params;
 
-static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
-                               Usz height, Usz width, Usz y, Usz x, Isz delta_y,
-                               Isz delta_x, Glyph g) {
-  Isz y0 = (Isz)y + delta_y;
-  Isz x0 = (Isz)x + delta_x;
-  if (y0 < 0 || x0 < 0 || (Usz)y0 >= height || (Usz)x0 >= width)
-    return;
-  Usz offs = (Usz)y0 * width + (Usz)x0;
-  gbuffer[offs] = g;
-  mbuffer[offs] |= Mark_flag_sleep;
-}
-
 // For anyone editing this in the future: the "no inline" here is deliberate.
 // You may think that inlining is always faster. Or even just letting the
 // compiler decide. You would be wrong. Try it. If you really want this VM to
@@ -135,14 +136,14 @@ static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
 #define PEEK(_delta_y, _delta_x)                                               \
   gbuffer_peek_relative(gbuffer, height, width, y, x, _delta_y, _delta_x)
 #define POKE(_delta_y, _delta_x, _glyph)                                       \
-  gbuffer_poke_relative(gbuffer, height, width, y, x, _delta_y, _delta_x,      \
-                        _glyph)
+  oper_poke(gbuffer, height, width, y, x, _delta_y, _delta_x, _glyph,          \
+            extra_params->oper_index)
 #define STUN(_delta_y, _delta_x)                                               \
   mbuffer_poke_relative_flags_or(mbuffer, height, width, y, x, _delta_y,       \
                                  _delta_x, Mark_flag_sleep)
 #define POKE_STUNNED(_delta_y, _delta_x, _glyph)                               \
   oper_poke_and_stun(gbuffer, mbuffer, height, width, y, x, _delta_y,          \
-                     _delta_x, _glyph)
+                     _delta_x, _glyph, extra_params->oper_index)
 #define LOCK(_delta_y, _delta_x)                                               \
   mbuffer_poke_relative_flags_or(mbuffer, height, width, y, x, _delta_y,       \
                                  _delta_x, Mark_flag_lock)
@@ -167,6 +168,145 @@ static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
                                    _delta_x, (_flags) ^ Mark_flag_lock);        \
     (void)(_tooltip); /* Suppress unused parameter warning for now */          \
   } while(0)
+
+// Where an operator is done marking its ports and locks. orca_mark() runs each
+// operator only up to here, so nothing before it may write to the grid, add
+// events, or touch the operator's state -- only PEEK, PORT, LOCK and STUN.
+#define PORTS_DONE                                                             \
+  if (extra_params->mark_only)                                                 \
+  return
+//////// Operator state
+
+// Arpeggiator state for tracking position
+typedef struct {
+  Usz step_counter;
+  Usz last_pattern;
+  Usz last_range;
+} Arp_state;
+
+typedef struct {
+  Usz current_index; // Current position in waveform
+  bool initialized;
+  Usz last_rate;  // Track rate changes
+  Usz last_shape; // Track shape changes
+} Bouncer_state;
+
+// BOORCH's shuffled random for lowercase 'r'. Holds a shuffled run of the
+// values between min and max, and hands them out one at a time. Each 'r' has
+// its own PCG32 stream, seeded from the random seed and its position, so its
+// sequence doesn't depend on any other 'r' in the grid.
+enum { Unique_random_max_sequence = 36 }; // For values 0-9 and A-Z
+
+typedef struct {
+  U64 rng_state;
+  U8 sequence[Unique_random_max_sequence];
+  U8 current_index;
+  U8 sequence_size;
+  U8 last_min; // Detect range changes
+  U8 last_max; // and force reinitialization
+  bool seeded;
+  bool initialized;
+} Unique_random_state;
+
+// One slot in the open-addressed table. A zeroed slot is empty, and a new
+// entry starts out zeroed, which is the initial state for every operator.
+struct Oper_state_slot {
+  U16 y, x;
+  Glyph oper_char; // the operator that owns the state, or 0 for empty
+  union {
+    Arp_state arp;
+    Bouncer_state bouncer;
+    Unique_random_state unique_random;
+  } state;
+};
+
+static ORCA_FORCEINLINE Usz oper_state_hash(Usz y, Usz x, Glyph oper_char) {
+  U32 h = ((U32)y << 16 | (U32)x) * 0x9e3779b1u ^ (U32)(U8)oper_char;
+  h ^= h >> 15;
+  return h;
+}
+
+// Moves the entries whose cell still holds the operator that owns them into a
+// new table, and drops the rest. Entries are only ever removed this way, so a
+// table never holds more than the live operators plus whatever went stale
+// since it last grew.
+static ORCA_NOINLINE void oper_state_store_rehash(Oper_state_store *ss,
+                                                  Glyph const *gbuf,
+                                                  Usz height, Usz width) {
+  Oper_state_slot *old_slots = ss->slots;
+  Usz old_cap = ss->capacity;
+  Usz live = 0;
+  for (Usz i = 0; i < old_cap; ++i) {
+    Oper_state_slot const *s = &old_slots[i];
+    if (s->oper_char && s->y < height && s->x < width &&
+        gbuf[s->y * width + s->x] == s->oper_char)
+      ++live;
+  }
+  // Keep the load factor at or below a half after the next insert.
+  Usz cap = orca_round_up_power2((live + 1) * 2);
+  if (cap < 16)
+    cap = 16;
+  Oper_state_slot *slots = calloc(cap, sizeof(Oper_state_slot));
+  Usz mask = cap - 1;
+  for (Usz i = 0; i < old_cap; ++i) {
+    Oper_state_slot const *s = &old_slots[i];
+    if (!s->oper_char || s->y >= height || s->x >= width ||
+        gbuf[s->y * width + s->x] != s->oper_char)
+      continue;
+    Usz j = oper_state_hash(s->y, s->x, s->oper_char) & mask;
+    while (slots[j].oper_char)
+      j = (j + 1) & mask;
+    slots[j] = *s;
+  }
+  free(old_slots);
+  ss->slots = slots;
+  ss->count = live;
+  ss->capacity = cap;
+}
+
+// Finds the state for the operator at (y, x), adding a zeroed entry for it if
+// there isn't one yet. The returned pointer is only good until the next call.
+static Oper_state_slot *oper_state_get(Oper_state_store *ss, Glyph const *gbuf,
+                                       Usz height, Usz width, Usz y, Usz x,
+                                       Glyph oper_char) {
+  if (ss->capacity) {
+    Usz mask = ss->capacity - 1;
+    for (Usz i = oper_state_hash(y, x, oper_char) & mask;; i = (i + 1) & mask) {
+      Oper_state_slot *s = &ss->slots[i];
+      if (!s->oper_char)
+        break;
+      if (s->y == y && s->x == x && s->oper_char == oper_char)
+        return s;
+    }
+  }
+  if ((ss->count + 1) * 4 > ss->capacity * 3)
+    oper_state_store_rehash(ss, gbuf, height, width);
+  Usz mask = ss->capacity - 1;
+  Usz i = oper_state_hash(y, x, oper_char) & mask;
+  while (ss->slots[i].oper_char)
+    i = (i + 1) & mask;
+  Oper_state_slot *s = &ss->slots[i];
+  s->y = (U16)y;
+  s->x = (U16)x;
+  s->oper_char = oper_char;
+  ++ss->count;
+  return s;
+}
+
+void oper_state_store_init(Oper_state_store *ss) {
+  ss->slots = NULL;
+  ss->count = 0;
+  ss->capacity = 0;
+}
+
+void oper_state_store_deinit(Oper_state_store *ss) { free(ss->slots); }
+
+void oper_state_store_clear(Oper_state_store *ss) {
+  if (ss->capacity)
+    memset(ss->slots, 0, ss->capacity * sizeof(Oper_state_slot));
+  ss->count = 0;
+}
+
 //////// Operators
 
 #define UNIQUE_OPERATORS(_)                                                    \
@@ -179,6 +319,8 @@ static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
   _(';', arpeggiator)                                                          \
   _('=', midichord)                                                            \
   _('?', midipb)                                                               \
+  _('^', osc)                                                                  \
+  _('|', udp)                                                                  \
   _('&', bouncer)
 
 #define ALPHA_OPERATORS(_)                                                     \
@@ -209,7 +351,62 @@ static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
   _('Y', yump)                                                                 \
   _('Z', lerp)
 
+// Which glyphs have a behavior. Everything else is inert when the VM reaches
+// it, so the operator index only needs to track these.
+static bool const glyph_is_oper_table[256] = {
+#define UNIQUE_ENTRY(_oper_char, _oper_name) [(U8)_oper_char] = true,
+#define ALPHA_ENTRY(_upper_oper_char, _oper_name)                              \
+  [(U8)_upper_oper_char] = true, [(U8)(_upper_oper_char | 1 << 5)] = true,
+    UNIQUE_OPERATORS(UNIQUE_ENTRY) ALPHA_OPERATORS(ALPHA_ENTRY)
+#undef UNIQUE_ENTRY
+#undef ALPHA_ENTRY
+};
+
+// Keeps the index in sync with a glyph that was just written to (y, x).
+static ORCA_FORCEINLINE void oper_index_note(Oper_index *oi, Usz y, Usz x,
+                                             Glyph g) {
+  U64 *word = oi->bits + y * oi->words_per_row + (x >> 6);
+  U64 bit = (U64)1 << (x & 63);
+  if (glyph_is_oper_table[(U8)g]) {
+    if (!(*word & bit)) {
+      *word |= bit;
+      ++oi->row_counts[y];
+    }
+  } else if (*word & bit) {
+    *word &= ~bit;
+    --oi->row_counts[y];
+  }
+}
+
+static ORCA_FORCEINLINE void oper_poke(Glyph *restrict gbuffer, Usz height,
+                                       Usz width, Usz y, Usz x, Isz delta_y,
+                                       Isz delta_x, Glyph g,
+                                       Oper_index *oper_index) {
+  Isz y0 = (Isz)y + delta_y;
+  Isz x0 = (Isz)x + delta_x;
+  if (y0 < 0 || x0 < 0 || (Usz)y0 >= height || (Usz)x0 >= width)
+    return;
+  gbuffer[(Usz)y0 * width + (Usz)x0] = g;
+  if (oper_index)
+    oper_index_note(oper_index, (Usz)y0, (Usz)x0, g);
+}
+
+static void oper_poke_and_stun(Glyph *restrict gbuffer, Mark *restrict mbuffer,
+                               Usz height, Usz width, Usz y, Usz x, Isz delta_y,
+                               Isz delta_x, Glyph g, Oper_index *oper_index) {
+  Isz y0 = (Isz)y + delta_y;
+  Isz x0 = (Isz)x + delta_x;
+  if (y0 < 0 || x0 < 0 || (Usz)y0 >= height || (Usz)x0 >= width)
+    return;
+  Usz offs = (Usz)y0 * width + (Usz)x0;
+  gbuffer[offs] = g;
+  mbuffer[offs] |= Mark_flag_sleep;
+  if (oper_index)
+    oper_index_note(oper_index, (Usz)y0, (Usz)x0, g);
+}
+
 BEGIN_OPERATOR(movement)
+  PORTS_DONE;
   if (glyph_is_lowercase(This_oper_char) &&
       !oper_has_neighboring_bang(gbuffer, height, width, y, x))
     return;
@@ -239,8 +436,11 @@ BEGIN_OPERATOR(movement)
   }
   Isz y0 = (Isz)y + delta_y;
   Isz x0 = (Isz)x + delta_x;
+  Oper_index *oper_index = extra_params->oper_index;
   if (y0 >= (Isz)height || x0 >= (Isz)width || y0 < 0 || x0 < 0) {
     gbuffer[y * width + x] = '*';
+    if (oper_index)
+      oper_index_note(oper_index, y, x, '*');
     return;
   }
   Glyph *restrict g_at_dest = gbuffer + (Usz)y0 * width + (Usz)x0;
@@ -248,8 +448,14 @@ BEGIN_OPERATOR(movement)
     *g_at_dest = This_oper_char;
     gbuffer[y * width + x] = '.';
     mbuffer[(Usz)y0 * width + (Usz)x0] |= Mark_flag_sleep;
+    if (oper_index) {
+      oper_index_note(oper_index, (Usz)y0, (Usz)x0, This_oper_char);
+      oper_index_note(oper_index, y, x, '.');
+    }
   } else {
     gbuffer[y * width + x] = '*';
+    if (oper_index)
+      oper_index_note(oper_index, y, x, '*');
   }
 END_OPERATOR
 
@@ -448,116 +654,126 @@ END_OPERATOR
 //   }
 // END_OPERATOR
 
-// MIDI CC Interpolation State Management
+// MIDI CC interpolation. Only the ramps that are still moving are kept in the
+// list, and index maps each channel and control to its ramp in it. The last
+// value sent for every channel and control is remembered, so that a new ramp
+// starts from wherever the previous one, or a plain CC, left off.
+enum {
+  Midicc_count = 16 * 128,
+  Midicc_no_ramp = 0xFFFF,
+};
+
 typedef struct {
-  bool active;
-  double current_value;    // Current interpolated value (0-127)
-  double target_value;     // Target value (0-127)
-  double step_size;        // Step increment per sub-frame
-  double steps_remaining;  // Remaining interpolation steps
-  U8 channel;              // MIDI channel
-  U8 control;              // MIDI control number
-  Usz last_tick;           // Last tick this was updated
-} Midicc_interp_state;
-
-#define MAX_MIDICC_INTERP_STATES 4096
-static Midicc_interp_state midicc_interp_states[MAX_MIDICC_INTERP_STATES] = {0};
-
-// Function to process interpolated MIDI CC events and update states
-void process_interpolated_midi_cc_event(Oevent_midi_cc_interpolated const *event, Usz tick_number) {
-  // Calculate unique state index based on channel and control
-  // This ensures each CC channel+control combination has its own interpolation state
-  Usz state_index = (event->channel * 128 + event->control) % MAX_MIDICC_INTERP_STATES;
-  Midicc_interp_state *state = &midicc_interp_states[state_index];
-  
-  // Convert interpolation rate (0-35) to actual steps
-  // Rate 0 = instant (1 step), rate 1 = slow (many steps), rate 35 = fast (few steps)
-  double steps_per_frame = 1.0; // Default to instant
-  if (event->interpolation_rate > 0) {
-    // Map rate 1-35 to interpolation speeds
-    // Lower rate = slower interpolation = more steps
-    // Higher rate = faster interpolation = fewer steps
-    steps_per_frame = 36.0 - (double)event->interpolation_rate; // Rate 1 = 35 steps, rate 35 = 1 step
-  }
-  
-  double target_value = (double)event->target_value;
-  
-  // Initialize or update state
-  if (!state->active || state->channel != event->channel || 
-      state->control != event->control) {
-    // New interpolation or different CC - start fresh
-    state->active = true;
-    state->channel = event->channel;
-    state->control = event->control;
-    // Start from current value or 0 for new CC
-    state->current_value = 0.0; // TODO: Could track actual current value
-    state->target_value = target_value;
-    if (steps_per_frame > 1.0) {
-      state->steps_remaining = steps_per_frame;
-      state->step_size = (target_value - state->current_value) / steps_per_frame;
-    } else {
-      // Instant mode - jump to target immediately
-      state->current_value = target_value;
-      state->steps_remaining = 1.0; // Will generate one event then stop
-      state->step_size = 0;
-    }
+  double value;  // Where the ramp is now (0-127)
+  double target; // Where it stops (0-127)
+  double speed;  // CC units per second, signed. 0 jumps straight to target.
+  U16 cc;        // channel * 128 + control
+} Midicc_ramp;
+
+struct Midicc_interp {
+  Midicc_ramp *ramps;
+  Usz count, capacity;
+  U16 index[Midicc_count];
+  U8 last_value[Midicc_count];
+};
+
+static Midicc_interp *midicc_interp_create(void) {
+  Midicc_interp *mi = malloc(sizeof(Midicc_interp));
+  mi->ramps = NULL;
+  mi->count = mi->capacity = 0;
+  memset(mi->index, 0xFF, sizeof mi->index);
+  memset(mi->last_value, 0, sizeof mi->last_value);
+  return mi;
+}
+
+static void midicc_interp_destroy(Midicc_interp *mi) {
+  free(mi->ramps);
+  free(mi);
+}
+
+// A ramp from a midicc operator with an interpolation rate of 1 to 34 takes
+// (36 - rate) ticks, so rate 1 is the slowest and rate 34 the fastest. Rates 0
+// and 35 both jump straight to the value.
+void process_interpolated_midi_cc_event(
+    Orca_vm *vm, Oevent_midi_cc_interpolated const *event, double tick_secs) {
+  Midicc_interp *mi = vm->midicc_interp;
+  if (event->channel > 15 || event->control > 127)
+    return;
+  U16 cc = (U16)(event->channel * 128u + event->control);
+  Midicc_ramp *ramp;
+  if (mi->index[cc] != Midicc_no_ramp) {
+    // Already moving. Carry on from wherever it's got to.
+    ramp = &mi->ramps[mi->index[cc]];
   } else {
-    // Continuing interpolation - calculate new path to target from current position
-    double delta = target_value - state->current_value;
-    state->target_value = target_value;
-    if (steps_per_frame > 1.0 && delta != 0.0) {
-      state->steps_remaining = steps_per_frame;
-      state->step_size = delta / steps_per_frame;
-    } else {
-      // Instant mode or no change needed
-      state->current_value = target_value;
-      state->steps_remaining = 1.0; // Will generate one event then stop
-      state->step_size = 0;
+    if (mi->count == mi->capacity) {
+      Usz cap = mi->capacity ? mi->capacity * 2 : 16;
+      mi->ramps = realloc(mi->ramps, cap * sizeof(Midicc_ramp));
+      mi->capacity = cap;
     }
+    mi->index[cc] = (U16)mi->count;
+    ramp = &mi->ramps[mi->count++];
+    ramp->value = (double)mi->last_value[cc];
+    ramp->cc = cc;
   }
-  
-  state->last_tick = tick_number;
+  ramp->target = (double)event->target_value;
+  ramp->speed = 0.0;
+  Usz rate = event->interpolation_rate;
+  // Rates 0 and 35 leave the speed at 0, which jumps to the target.
+  if (rate > 0 && rate < 35 && tick_secs > 0.0)
+    ramp->speed =
+        (ramp->target - ramp->value) / ((double)(36 - rate) * tick_secs);
 }
 
-// Function to advance all active interpolations and generate MIDI CC events
-void advance_midi_cc_interpolations(double delta_time, Oevent_list *oevent_list) {
-  for (Usz i = 0; i < MAX_MIDICC_INTERP_STATES; i++) {
-    Midicc_interp_state *state = &midicc_interp_states[i];
-    
-    if (!state->active || state->steps_remaining <= 0) {
+void advance_midi_cc_interpolations(Orca_vm *vm, double delta_time,
+                                    Oevent_list *oevent_list) {
+  Midicc_interp *mi = vm->midicc_interp;
+  Usz i = 0;
+  while (i < mi->count) {
+    Midicc_ramp *ramp = &mi->ramps[i];
+    double value = ramp->value + ramp->speed * delta_time;
+    bool done = ramp->speed > 0.0   ? value >= ramp->target
+                : ramp->speed < 0.0 ? value <= ramp->target
+                                    : true;
+    if (done)
+      value = ramp->target;
+    ramp->value = value;
+    U8 cc_value = (U8)(value + 0.5);
+    U16 cc = ramp->cc;
+    // Only send when the value actually changes, except for an instant ramp,
+    // which always sends exactly once.
+    if (cc_value != mi->last_value[cc] || ramp->speed == 0.0) {
+      mi->last_value[cc] = cc_value;
+      Oevent_midi_cc *oe = (Oevent_midi_cc *)oevent_list_alloc_item(
+          oevent_list, sizeof(Oevent_midi_cc));
+      oe->oevent_type = Oevent_type_midi_cc;
+      oe->channel = (U8)(cc >> 7);
+      oe->control = (U8)(cc & 127);
+      oe->value = cc_value;
+    }
+    if (!done) {
+      ++i;
       continue;
     }
-    
-    // Advance interpolation based on delta time
-    // For simplicity, we advance by one step per frame, but could use delta_time for sub-frame accuracy
-    double steps_to_advance = 1.0; // Could be: delta_time * interpolation_speed_factor
-    (void)delta_time; // Mark as used to avoid warning
-    
-    state->current_value += state->step_size * steps_to_advance;
-    state->steps_remaining -= steps_to_advance;
-    
-    // Clamp to target if we've reached or passed it
-    if ((state->step_size > 0 && state->current_value >= state->target_value) ||
-        (state->step_size < 0 && state->current_value <= state->target_value) ||
-        state->steps_remaining <= 0) {
-      state->current_value = state->target_value;
-      state->steps_remaining = 0;
-      state->active = false; // Mark as complete
+    // Move the last ramp into this one's place, and look at this index again.
+    mi->index[cc] = Midicc_no_ramp;
+    Usz last = --mi->count;
+    if (i != last) {
+      mi->ramps[i] = mi->ramps[last];
+      mi->index[mi->ramps[i].cc] = (U16)i;
     }
-    
-    // Clamp to valid MIDI range
-    if (state->current_value > 127.0) state->current_value = 127.0;
-    if (state->current_value < 0.0) state->current_value = 0.0;
-    
-    // Generate MIDI CC event with interpolated value
-    Oevent_midi_cc *oe = (Oevent_midi_cc *)oevent_list_alloc_item(oevent_list);
-    oe->oevent_type = Oevent_type_midi_cc;
-    oe->channel = state->channel;
-    oe->control = state->control;
-    oe->value = (U8)(state->current_value + 0.5); // Round to nearest integer
   }
 }
 
+bool has_midi_cc_interpolations(Orca_vm const *vm) {
+  return vm->midicc_interp->count > 0;
+}
+
+void set_midi_cc_value(Orca_vm *vm, U8 channel, U8 control, U8 value) {
+  if (channel > 15 || control > 127)
+    return;
+  vm->midicc_interp->last_value[channel * 128u + control] = value;
+}
+
 BEGIN_OPERATOR(midicc)
   PORT(0, 1, IN | PARAM, "Channel");
   PORT(0, 2, IN | PARAM, "Control (hundreds)");
@@ -565,6 +781,7 @@ BEGIN_OPERATOR(midicc)
   PORT(0, 4, IN | PARAM, "Control (ones)");
   PORT(0, 5, IN | PARAM, "Value");
   PORT(0, 6, IN | PARAM, "Interpolation Rate");
+  PORTS_DONE;
   STOP_IF_NOT_BANGED;
   Glyph channel_g = PEEK(0, 1);
   Glyph control_h = PEEK(0, 2);  // hundreds
@@ -599,8 +816,8 @@ BEGIN_OPERATOR(midicc)
   // Handle interpolation rate
   if (interp_rate_g == '.') {
     // No interpolation - send immediate CC
-    Oevent_midi_cc *oe =
-        (Oevent_midi_cc *)oevent_list_alloc_item(extra_params->oevent_list);
+    Oevent_midi_cc *oe = (Oevent_midi_cc *)oevent_list_alloc_item(
+        extra_params->oevent_list, sizeof(Oevent_midi_cc));
     oe->oevent_type = Oevent_type_midi_cc;
     oe->channel = (U8)channel;
     oe->control = (U8)control_num;
@@ -608,7 +825,8 @@ BEGIN_OPERATOR(midicc)
   } else {
     // Send interpolated CC event
     Oevent_midi_cc_interpolated *oe =
-        (Oevent_midi_cc_interpolated *)oevent_list_alloc_item(extra_params->oevent_list);
+        (Oevent_midi_cc_interpolated *)oevent_list_alloc_item(
+            extra_params->oevent_list, sizeof(Oevent_midi_cc_interpolated));
     oe->oevent_type = Oevent_type_midi_cc_interpolated;
     oe->channel = (U8)channel;
     oe->control = (U8)control_num;
@@ -633,7 +851,10 @@ BEGIN_OPERATOR(comment)
 END_OPERATOR
 
 BEGIN_OPERATOR(bang)
+  PORTS_DONE;
   gbuffer_poke(gbuffer, height, width, y, x, '.');
+  if (extra_params->oper_index)
+    oper_index_note(extra_params->oper_index, y, x, '.');
 END_OPERATOR
 
 BEGIN_OPERATOR(midi)
@@ -642,6 +863,7 @@ BEGIN_OPERATOR(midi)
   PORT(0, 3, IN | PARAM, "Note");
   PORT(0, 4, IN | PARAM, "Velocity");
   PORT(0, 5, IN | PARAM, "Length");
+  PORTS_DONE;
   STOP_IF_NOT_BANGED;
   Glyph channel_g = PEEK(0, 1);
   Glyph octave_g = PEEK(0, 2);
@@ -671,8 +893,8 @@ BEGIN_OPERATOR(midi)
       vel_num = 127;
   }
   PORT(0, 0, OUT, "");
-  Oevent_midi_note *oe =
-      (Oevent_midi_note *)oevent_list_alloc_item(extra_params->oevent_list);
+  Oevent_midi_note *oe = (Oevent_midi_note *)oevent_list_alloc_item(
+      extra_params->oevent_list, sizeof(Oevent_midi_note));
   oe->oevent_type = (U8)Oevent_type_midi_note;
   oe->channel = (U8)channel_num;
   oe->octave = octave_num;
@@ -682,60 +904,63 @@ BEGIN_OPERATOR(midi)
   oe->mono = This_oper_char == '%' ? 1 : 0;
 END_OPERATOR
 
-// BEGIN_OPERATOR(udp)
-//   Usz n = width - x - 1;
-//   if (n > 16)
-//     n = 16;
-//   Glyph const *restrict gline = gbuffer + y * width + x + 1;
-//   Mark *restrict mline = mbuffer + y * width + x + 1;
-//   Glyph cpy[Oevent_udp_string_count];
-//   Usz i;
-//   for (i = 0; i < n; ++i) {
-//     Glyph g = gline[i];
-//     if (g == '.')
-//       break;
-//     cpy[i] = g;
-//     mline[i] |= Mark_flag_lock;
-//   }
-//   n = i;
-//   STOP_IF_NOT_BANGED;
-//   PORT(0, 0, OUT);
-//   Oevent_udp_string *oe =
-//       (Oevent_udp_string *)oevent_list_alloc_item(extra_params->oevent_list);
-//   oe->oevent_type = (U8)Oevent_type_udp_string;
-//   oe->count = (U8)n;
-//   for (i = 0; i < n; ++i) {
-//     oe->chars[i] = cpy[i];
-//   }
-// END_OPERATOR
+// Sends the characters to its right, up to the first '.', as a raw UDP
+// datagram.
+BEGIN_OPERATOR(udp)
+  Usz n = width - x - 1;
+  if (n > Oevent_udp_string_count)
+    n = Oevent_udp_string_count;
+  Glyph const *restrict gline = gbuffer + y * width + x + 1;
+  Mark *restrict mline = mbuffer + y * width + x + 1;
+  Usz i;
+  for (i = 0; i < n; ++i) {
+    if (gline[i] == '.')
+      break;
+    mline[i] |= Mark_flag_lock;
+  }
+  n = i;
+  PORTS_DONE;
+  STOP_IF_NOT_BANGED;
+  PORT(0, 0, OUT, "");
+  Oevent_udp_string *oe =
+      &oevent_list_alloc_item(extra_params->oevent_list,
+                              sizeof(Oevent_udp_string) + n)
+           ->udp_string;
+  oe->oevent_type = (U8)Oevent_type_udp_string;
+  oe->count = (U8)n;
+  memcpy((char *)oe + sizeof *oe, gline, n);
+END_OPERATOR
 
-// BEGIN_OPERATOR(osc)
-//   PORT(0, 1, IN | PARAM);
-//   PORT(0, 2, IN | PARAM);
-//   Usz len = index_of(PEEK(0, 2));
-//   if (len > Oevent_osc_int_count)
-//     len = Oevent_osc_int_count;
-//   for (Usz i = 0; i < len; ++i) {
-//     PORT(0, (Isz)i + 3, IN);
-//   }
-//   STOP_IF_NOT_BANGED;
-//   Glyph g = PEEK(0, 1);
-//   if (g != '.') {
-//     PORT(0, 0, OUT);
-//     U8 buff[Oevent_osc_int_count];
-//     for (Usz i = 0; i < len; ++i) {
-//       buff[i] = (U8)index_of(PEEK(0, (Isz)i + 3));
-//     }
-//     Oevent_osc_ints *oe =
-//         &oevent_list_alloc_item(extra_params->oevent_list)->osc_ints;
-//     oe->oevent_type = (U8)Oevent_type_osc_ints;
-//     oe->glyph = g;
-//     oe->count = (U8)len;
-//     for (Usz i = 0; i < len; ++i) {
-//       oe->numbers[i] = buff[i];
-//     }
-//   }
-// END_OPERATOR
+// Sends the values to its right as an OSC message of 32-bit ints. The path is
+// the glyph after the operator, like /a, and the glyph after that is how many
+// values follow.
+BEGIN_OPERATOR(osc)
+  PORT(0, 1, IN | PARAM, "Path");
+  PORT(0, 2, IN | PARAM, "Length");
+  Usz len = index_of(PEEK(0, 2));
+  if (len > Oevent_osc_int_count)
+    len = Oevent_osc_int_count;
+  for (Usz i = 0; i < len; ++i) {
+    PORT(0, (Isz)i + 3, IN, "Value");
+  }
+  PORTS_DONE;
+  STOP_IF_NOT_BANGED;
+  Glyph g = PEEK(0, 1);
+  if (g != '.') {
+    PORT(0, 0, OUT, "");
+    Oevent_osc_ints *oe =
+        &oevent_list_alloc_item(extra_params->oevent_list,
+                                sizeof(Oevent_osc_ints) + len)
+             ->osc_ints;
+    oe->oevent_type = (U8)Oevent_type_osc_ints;
+    oe->glyph = g;
+    oe->count = (U8)len;
+    U8 *numbers = (U8 *)oe + sizeof *oe;
+    for (Usz i = 0; i < len; ++i) {
+      numbers[i] = (U8)index_of(PEEK(0, (Isz)i + 3));
+    }
+  }
+END_OPERATOR
 
 // BOORCH's MIDIChord operator
 // Note: Chord definitions moved to unified scales_and_chords system below
@@ -746,6 +971,7 @@ BEGIN_OPERATOR(midipb)
   PORT(0, 2, IN | PARAM, "MSB");
   PORT(0, 3, IN | PARAM, "LSB");
   PORT(0, 0, OUT, ""); // Mark output immediately
+  PORTS_DONE;
   STOP_IF_NOT_BANGED;
   Glyph channel_g = PEEK(0, 1);
   Glyph msb_g = PEEK(0, 2);
@@ -755,8 +981,8 @@ BEGIN_OPERATOR(midipb)
   Usz channel = index_of(channel_g);
   if (channel > 15)
     return;
-  Oevent_midi_pb *oe =
-      (Oevent_midi_pb *)oevent_list_alloc_item(extra_params->oevent_list);
+  Oevent_midi_pb *oe = (Oevent_midi_pb *)oevent_list_alloc_item(
+      extra_params->oevent_list, sizeof(Oevent_midi_pb));
   oe->oevent_type = Oevent_type_midi_pb;
   oe->channel = (U8)channel;
   oe->msb = (U8)(index_of(msb_g) * 127 / 35); // 0~35 -> 0~127
@@ -768,6 +994,7 @@ BEGIN_OPERATOR(add)
   PORT(0, -1, IN | PARAM, "Value A");
   PORT(0, 1, IN, "Value B");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph a = PEEK(0, -1);
   Glyph b = PEEK(0, 1);
   Glyph g = glyph_table[(index_of(a) + index_of(b)) % Glyphs_index_count];
@@ -779,6 +1006,7 @@ BEGIN_OPERATOR(subtract)
   PORT(0, -1, IN | PARAM, "Value A");
   PORT(0, 1, IN, "Value B");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph a = PEEK(0, -1);
   Glyph b = PEEK(0, 1);
   Isz val = (Isz)index_of(b) - (Isz)index_of(a);
@@ -792,6 +1020,7 @@ BEGIN_OPERATOR(clock)
   PORT(0, -1, IN | PARAM, "Rate");
   PORT(0, 1, IN, "Modulo");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph b = PEEK(0, 1);
   Usz rate = index_of(PEEK(0, -1));
   Usz mod_num = index_of(b);
@@ -808,6 +1037,7 @@ BEGIN_OPERATOR(delay)
   PORT(0, -1, IN | PARAM, "Rate");
   PORT(0, 1, IN, "Modulo");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Usz rate = index_of(PEEK(0, -1));
   Usz mod_num = index_of(PEEK(0, 1));
   if (rate == 0)
@@ -823,6 +1053,7 @@ BEGIN_OPERATOR(if)
   PORT(0, -1, IN | PARAM, "Value A");
   PORT(0, 1, IN, "Value B");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph g0 = PEEK(0, -1);
   Glyph g1 = PEEK(0, 1);
   POKE(1, 0, g0 == g1 ? '*' : '.');
@@ -839,6 +1070,9 @@ BEGIN_OPERATOR(generator)
   for (Isz i = 0; i < len; ++i) {
     PORT(0, i + 1, IN | PARAM, "Input");
     PORT(out_y, out_x + i, OUT | NONLOCKING, "");
+  }
+  PORTS_DONE;
+  for (Isz i = 0; i < len; ++i) {
     Glyph g = PEEK(0, i + 1);
     POKE_STUNNED(out_y, out_x + i, g);
   }
@@ -854,6 +1088,7 @@ BEGIN_OPERATOR(increment)
   PORT(0, -1, IN | PARAM, "Rate");
   PORT(0, 1, IN, "Max");
   PORT(1, 0, IN | OUT, "");
+  PORTS_DONE;
   Glyph ga = PEEK(0, -1);
   Glyph gb = PEEK(0, 1);
   Usz rate = 1;
@@ -877,6 +1112,7 @@ BEGIN_OPERATOR(jump)
   for (Isz i = 1; i <= 256; ++i) {
     if (PEEK(i, 0) != This_oper_char) {
       PORT(i, 0, OUT, "");
+      PORTS_DONE;
       POKE(i, 0, g);
       break;
     }
@@ -894,11 +1130,15 @@ BEGIN_OPERATOR(konkat)
   PORT(0, -1, IN | PARAM, "Length");
   for (Isz i = 0; i < len; ++i) {
     PORT(0, i + 1, IN | PARAM, "Variable");
+    if (PEEK(0, i + 1) != '.')
+      PORT(1, i + 1, OUT, "");
+  }
+  PORTS_DONE;
+  for (Isz i = 0; i < len; ++i) {
     Glyph var = PEEK(0, i + 1);
     if (var != '.') {
       Usz var_idx = index_of(var);
       Glyph result = extra_params->vars_slots[var_idx];
-      PORT(1, i + 1, OUT, "");
       POKE(1, i + 1, result);
     }
   }
@@ -909,6 +1149,7 @@ BEGIN_OPERATOR(lesser)
   PORT(0, -1, IN | PARAM, "Value A");
   PORT(0, 1, IN, "Value B");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph ga = PEEK(0, -1);
   Glyph gb = PEEK(0, 1);
   if (ga == '.' || gb == '.') {
@@ -926,6 +1167,7 @@ BEGIN_OPERATOR(multiply)
   PORT(0, -1, IN | PARAM, "Factor A");
   PORT(0, 1, IN, "Factor B");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph a = PEEK(0, -1);
   Glyph b = PEEK(0, 1);
   Glyph g = glyph_table[(index_of(a) * index_of(b)) % Glyphs_index_count];
@@ -940,6 +1182,7 @@ BEGIN_OPERATOR(offset)
   PORT(0, -2, IN | PARAM, "X offset");
   PORT(in_y, in_x, IN, "Input");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   POKE(1, 0, PEEK(in_y, in_x));
 END_OPERATOR
 
@@ -957,6 +1200,7 @@ BEGIN_OPERATOR(push)
     LOCK(1, (Isz)i);
   }
   PORT(1, out_x, OUT, "");
+  PORTS_DONE;
   POKE(1, out_x, PEEK(0, 1));
 END_OPERATOR
 
@@ -969,10 +1213,13 @@ BEGIN_OPERATOR(query)
   PORT(0, -3, IN | PARAM, "X offset"); // x
   PORT(0, -2, IN | PARAM, "Y offset"); // y
   PORT(0, -1, IN | PARAM, "Length"); // len
-  // todo direct buffer manip
   for (Isz i = 0; i < len; ++i) {
     PORT(in_y, in_x + i, IN, "Input");
     PORT(1, out_x + i, OUT, "");
+  }
+  PORTS_DONE;
+  // todo direct buffer manip
+  for (Isz i = 0; i < len; ++i) {
     Glyph g = PEEK(in_y, in_x + i);
     POKE(1, out_x + i, g);
   }
@@ -992,6 +1239,7 @@ BEGIN_OPERATOR(track)
   }
   PORT(0, (Isz)read_val_x, IN, "Input");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   POKE(1, 0, PEEK(0, read_val_x));
 END_OPERATOR
 
@@ -1002,6 +1250,7 @@ BEGIN_OPERATOR(uclid)
   PORT(0, -1, IN | PARAM, "Steps");
   PORT(0, 1, IN, "Max");
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
   Glyph left = PEEK(0, -1);
   Usz steps = 1;
   if (left != '.' && left != '*')
@@ -1020,13 +1269,15 @@ BEGIN_OPERATOR(variable)
   PORT(0, 1, IN, "Value");
   Glyph left = PEEK(0, -1);
   Glyph right = PEEK(0, 1);
+  if (left == '.' && right != '.')
+    PORT(1, 0, OUT, "");
+  PORTS_DONE;
   if (left != '.') {
     // Write
     Usz var_idx = index_of(left);
     extra_params->vars_slots[var_idx] = right;
   } else if (right != '.') {
     // Read
-    PORT(1, 0, OUT, "");
     Usz var_idx = index_of(right);
     Glyph result = extra_params->vars_slots[var_idx];
     POKE(1, 0, result);
@@ -1041,6 +1292,7 @@ BEGIN_OPERATOR(teleport)
   PORT(0, -1, IN | PARAM, "Y offset"); // y
   PORT(0, 1, IN, "Input");
   PORT(out_y, out_x, OUT | NONLOCKING, "");
+  PORTS_DONE;
   POKE_STUNNED(out_y, out_x, PEEK(0, 1));
 END_OPERATOR
 
@@ -1053,6 +1305,7 @@ BEGIN_OPERATOR(yump)
   for (Isz i = 1; i <= 256; ++i) {
     if (PEEK(0, i) != This_oper_char) {
       PORT(0, i, OUT, "");
+      PORTS_DONE;
       POKE(0, i, g);
       break;
     }
@@ -1065,6 +1318,7 @@ BEGIN_OPERATOR(lerp)
   PORT(0, -1, IN | PARAM, "Rate");
   PORT(0, 1, IN, "Target");
   PORT(1, 0, IN | OUT, "");
+  PORTS_DONE;
   Glyph g = PEEK(0, -1);
   Glyph b = PEEK(0, 1);
   Isz rate = g == '.' || g == '*' ? 1 : (Isz)index_of(g);
@@ -1207,6 +1461,7 @@ BEGIN_OPERATOR(scale)
   LOCK(0, 2);
   LOCK(0, 3);
   LOCK(0, 4);
+  PORTS_DONE;
 
   Glyph octave_g = PEEK(0, 1);
   Glyph root_note_glyph = PEEK(0, 2);
@@ -1312,6 +1567,7 @@ BEGIN_OPERATOR(midichord)
   PORT(0, 5, IN | PARAM, "Velocity");
   PORT(0, 6, IN | PARAM, "Length");
   PORT(0, 0, OUT, ""); // Mark output immediately
+  PORTS_DONE;
   STOP_IF_NOT_BANGED;
 
   // Get chord type and validate range (supports a-z and A-Z)
@@ -1393,8 +1649,8 @@ BEGIN_OPERATOR(midichord)
     U8 final_note = (U8)(note_absolute % 12);
 
     // Create MIDI event
-    Oevent_midi_note *oe =
-        (Oevent_midi_note *)oevent_list_alloc_item(extra_params->oevent_list);
+    Oevent_midi_note *oe = (Oevent_midi_note *)oevent_list_alloc_item(
+        extra_params->oevent_list, sizeof(Oevent_midi_note));
     oe->oevent_type = Oevent_type_midi_note;
     oe->channel = (U8)channel;
     oe->octave = final_octave;
@@ -1425,16 +1681,6 @@ typedef enum {
   ARP_PATTERN_COUNT
 } ArpPatternType;
 
-// Arpeggiator state for tracking position
-typedef struct {
-  Usz step_counter;
-  Usz last_pattern;
-  Usz last_range;
-} Arp_state;
-
-#define MAX_ARP_GRID_SIZE 4096
-static Arp_state arp_states[MAX_ARP_GRID_SIZE] = {0};
-
 // Function to get the degree based on pattern type and step
 static Usz get_arp_degree(ArpPatternType pattern, Usz step, Usz range, 
                          Oper_extra_params *extra_params) {
@@ -1561,13 +1807,12 @@ BEGIN_OPERATOR(arpeggiator)
   PORT(0, 1, IN | PARAM, "Range");  // Range (1-4)
   PORT(0, 2, IN | PARAM, "Pattern");  // Pattern (0-9, a-d)
   PORT(1, 0, OUT, "");         // Degree output
+  PORTS_DONE;
 
-  // Calculate state index
-  Usz state_idx = y * width + x;
-  if (state_idx >= MAX_ARP_GRID_SIZE)
-    return;
-
-  Arp_state *state = &arp_states[state_idx];
+  Arp_state *state =
+      &oper_state_get(&extra_params->vm->state_store, gbuffer, height, width, y,
+                      x, This_oper_char)
+           ->state.arp;
 
   // Get inputs
   Glyph range_g = PEEK(0, 1);
@@ -1599,51 +1844,60 @@ BEGIN_OPERATOR(arpeggiator)
 END_OPERATOR
 
 // BOORCH's new Random Unique
-#define MAX_SEQUENCE_SIZE 36 // For values 0-9 and A-Z
 
-typedef struct {
-  Usz sequence[MAX_SEQUENCE_SIZE];
-  Usz current_index;
-  Usz sequence_size;
-  bool initialized;
-  Usz last_min; // Add these to detect range changes
-  Usz last_max; // and force reinitialization
-} Unique_random_state;
+// PCG32.
+static U32 unique_random_next(Unique_random_state *urs) {
+  U64 old = urs->rng_state;
+  urs->rng_state = old * UINT64_C(6364136223846793005) +
+                   UINT64_C(1442695040888963407);
+  U32 xorshifted = (U32)(((old >> 18) ^ old) >> 27);
+  U32 rot = (U32)(old >> 59);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
 
-static Unique_random_state unique_random_state = {0};
+// SplitMix64 over the seed and position, so that neighboring cells and
+// neighboring seeds start far apart in the PCG32 sequence.
+static void unique_random_seed(Unique_random_state *urs, Usz random_seed,
+                               Usz y, Usz x) {
+  U64 z = (U64)random_seed +
+          ((U64)y << 32 | (U64)x) * UINT64_C(0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+  urs->rng_state = z ^ (z >> 31);
+  urs->seeded = true;
+}
 
-static void shuffle_sequence(Usz *array, Usz n) {
+static void shuffle_sequence(Unique_random_state *urs) {
+  U8 *array = urs->sequence;
+  Usz n = urs->sequence_size;
   if (n <= 1)
     return;
 
   for (Usz i = n - 1; i > 0; i--) {
-    // Use existing random generator from ORCA
-    Usz j = (Usz)(((U32)rand()) % (i + 1));
+    Usz j = (Usz)(unique_random_next(urs) % (i + 1));
     // Swap
-    Usz temp = array[i];
+    U8 temp = array[i];
     array[i] = array[j];
     array[j] = temp;
   }
 }
 
-static void initialize_sequence(Usz min, Usz max) {
-  unique_random_state.sequence_size = (max >= min) ? (max - min + 1) : 0;
-  if (unique_random_state.sequence_size > MAX_SEQUENCE_SIZE) {
-    unique_random_state.sequence_size = MAX_SEQUENCE_SIZE;
+static void initialize_sequence(Unique_random_state *urs, Usz min, Usz max) {
+  Usz size = (max >= min) ? (max - min + 1) : 0;
+  if (size > Unique_random_max_sequence) {
+    size = Unique_random_max_sequence;
   }
+  urs->sequence_size = (U8)size;
 
   // Fill sequence with values from min to max
-  for (Usz i = 0; i < unique_random_state.sequence_size; i++) {
-    unique_random_state.sequence[i] = min + i;
+  for (Usz i = 0; i < size; i++) {
+    urs->sequence[i] = (U8)(min + i);
   }
 
-  shuffle_sequence(unique_random_state.sequence,
-                   unique_random_state.sequence_size);
-  unique_random_state.current_index = 0;
+  shuffle_sequence(urs);
+  urs->current_index = 0;
 }
 
-void reset_last_unique_value(void) { unique_random_state.initialized = false; }
-
 // Modified random operator for lowercase 'r' - requires bang, uses shuffle to avoid consecutive duplicates
 BEGIN_OPERATOR(random)
   // Check if this is lowercase 'r' (shuffle/unique random) or uppercase 'R' (pure random)
@@ -1653,6 +1907,7 @@ BEGIN_OPERATOR(random)
     PORT(0, -1, IN | PARAM, "Min"); // Min
     PORT(0, 1, IN, "Max");          // Max
     PORT(1, 0, OUT, "");         // Output
+    PORTS_DONE;
 
     Glyph min_glyph = PEEK(0, -1);
     Glyph max_glyph = PEEK(0, 1);
@@ -1670,26 +1925,30 @@ BEGIN_OPERATOR(random)
       max = temp;
     }
 
+    Unique_random_state *urs =
+        &oper_state_get(&extra_params->vm->state_store, gbuffer, height,
+                        width, y, x, This_oper_char)
+             ->state.unique_random;
+    if (!urs->seeded)
+      unique_random_seed(urs, extra_params->random_seed, y, x);
+
     // Initialize or reinitialize if needed
-    if (!unique_random_state.initialized ||
-        unique_random_state.current_index >= unique_random_state.sequence_size ||
-        min != unique_random_state.last_min ||
-        max != unique_random_state.last_max) {
-      initialize_sequence(min, max);
-      unique_random_state.initialized = true;
-      unique_random_state.last_min = min;
-      unique_random_state.last_max = max;
+    if (!urs->initialized || urs->current_index >= urs->sequence_size ||
+        min != urs->last_min || max != urs->last_max) {
+      initialize_sequence(urs, min, max);
+      urs->initialized = true;
+      urs->last_min = (U8)min;
+      urs->last_max = (U8)max;
     }
 
     // Get next value from sequence
-    Usz result = unique_random_state.sequence[unique_random_state.current_index];
-    unique_random_state.current_index++;
+    Usz result = urs->sequence[urs->current_index];
+    urs->current_index++;
 
     // Reshuffle if we've used all values
-    if (unique_random_state.current_index >= unique_random_state.sequence_size) {
-      shuffle_sequence(unique_random_state.sequence,
-                       unique_random_state.sequence_size);
-      unique_random_state.current_index = 0;
+    if (urs->current_index >= urs->sequence_size) {
+      shuffle_sequence(urs);
+      urs->current_index = 0;
     }
 
     POKE(1, 0, glyph_of(result));
@@ -1698,6 +1957,7 @@ BEGIN_OPERATOR(random)
     PORT(0, -1, IN | PARAM, "Min");
     PORT(0, 1, IN, "Max");
     PORT(1, 0, OUT, "");
+    PORTS_DONE;
     Glyph gb = PEEK(0, 1);
     Usz a = index_of(PEEK(0, -1));
     Usz b = index_of(gb);
@@ -1759,21 +2019,13 @@ static const char *waveforms[] = {
 
 #define WAVE_LENGTH 128
 
-typedef struct {
-  Usz current_index; // Current position in waveform
-  bool initialized;
-  Usz last_rate;  // Track rate changes
-  Usz last_shape; // Track shape changes
-} Bouncer_state;
-
-static Bouncer_state bouncer_states[4096] = {0};
-
 BEGIN_OPERATOR(bouncer)
   PORT(0, 1, IN | PARAM, "Start"); // Start value (a)
   PORT(0, 2, IN | PARAM, "End"); // End value (b)
   PORT(0, 3, IN | PARAM, "Rate"); // Rate (ticks per cycle)
   PORT(0, 4, IN | PARAM, "Shape"); // Shape (0-7 for different waveforms)
   PORT(1, 0, OUT, "");
+  PORTS_DONE;
 
   Glyph start_g = PEEK(0, 1);
   Glyph end_g = PEEK(0, 2);
@@ -1783,8 +2035,10 @@ BEGIN_OPERATOR(bouncer)
   if (start_g == '.' || end_g == '.')
     return;
 
-  Usz state_idx = y * width + x;
-  Bouncer_state *state = &bouncer_states[state_idx];
+  Bouncer_state *state =
+      &oper_state_get(&extra_params->vm->state_store, gbuffer, height, width, y,
+                      x, This_oper_char)
+           ->state.bouncer;
 
   Usz start = index_of(start_g);
   Usz end = index_of(end_g);
@@ -1829,43 +2083,375 @@ END_OPERATOR
 
 //////// Run simulation
 
-void orca_run(Glyph *restrict gbuf, Mark *restrict mbuf, Usz height, Usz width,
-              Usz tick_number, Oevent_list *oevent_list, Usz random_seed) {
-  Glyph vars_slots[Glyphs_index_count];
-  memset(vars_slots, '.', sizeof(vars_slots));
-  Oper_extra_params extras;
-  extras.vars_slots = &vars_slots[0];
-  extras.oevent_list = oevent_list;
-  extras.random_seed = random_seed;
+// Operators are dispatched through the switch in run_cell(). Building with
+// -DORCA_SIM_TABLE_DISPATCH dispatches through a 256-entry table of operator
+// functions indexed by glyph instead, built from the same operator lists. It's
+// one load and an indirect call per live cell. It helps a little on grids that
+// are dominated by dispatch, but has measured slower on sparse ones, so it's
+// only there for comparing the two with the bench target.
+#ifdef ORCA_SIM_TABLE_DISPATCH
+typedef void (*Oper_behavior_fn)(Glyph *restrict gbuffer,
+                                 Mark *restrict mbuffer, Usz height, Usz width,
+                                 Usz y, Usz x, Usz Tick_number,
+                                 Oper_extra_params *extra_params,
+                                 Mark cell_flags, Glyph This_oper_char);
+
+static Oper_behavior_fn const oper_behavior_table[256] = {
+#define UNIQUE_ENTRY(_oper_char, _oper_name)                                   \
+  [(U8)_oper_char] = oper_behavior_##_oper_name,
+#define ALPHA_ENTRY(_upper_oper_char, _oper_name)                              \
+  [(U8)_upper_oper_char] = oper_behavior_##_oper_name,                         \
+  [(U8)(_upper_oper_char | 1 << 5)] = oper_behavior_##_oper_name,
+    UNIQUE_OPERATORS(UNIQUE_ENTRY) ALPHA_OPERATORS(ALPHA_ENTRY)
+#undef UNIQUE_ENTRY
+#undef ALPHA_ENTRY
+};
+#endif
+
+// Returns the index of the first cell in [x, width) of a row that needs to be
+// run -- not '.', and not locked or asleep -- or width if there isn't one.
+// Most grids are almost entirely '.', so this compares a whole vector of
+// glyphs and marks at a time where the target has SIMD. It only ever returns
+// the first live cell, and the caller scans again after running it, so any
+// writes the operator makes further along the row are still seen.
+static ORCA_FORCEINLINE Usz next_live_cell(Glyph const *glyph_row,
+                                           Mark const *mark_row, Usz x,
+                                           Usz width) {
+  // Dense rows tend to have live cells right next to each other, and it's not
+  // worth setting up the vector compare for those.
+  if (x < width && glyph_row[x] != '.' &&
+      !(mark_row[x] & (Mark_flag_lock | Mark_flag_sleep)))
+    return x;
+#if defined(ORCA_SIM_SCAN_AVX2)
+  __m256i const dots = _mm256_set1_epi8('.');
+  __m256i const busy = _mm256_set1_epi8(Mark_flag_lock | Mark_flag_sleep);
+  __m256i const zero = _mm256_setzero_si256();
+  for (; x + 32 <= width; x += 32) {
+    __m256i g = _mm256_loadu_si256((__m256i const *)(glyph_row + x));
+    __m256i m = _mm256_loadu_si256((__m256i const *)(mark_row + x));
+    __m256i is_dot = _mm256_cmpeq_epi8(g, dots);
+    __m256i is_awake = _mm256_cmpeq_epi8(_mm256_and_si256(m, busy), zero);
+    U32 live = (U32)_mm256_movemask_epi8(_mm256_andnot_si256(is_dot, is_awake));
+    if (live)
+      return x + (Usz)__builtin_ctz(live);
+  }
+#elif defined(ORCA_SIM_SCAN_SSE2)
+  __m128i const dots = _mm_set1_epi8('.');
+  __m128i const busy = _mm_set1_epi8(Mark_flag_lock | Mark_flag_sleep);
+  __m128i const zero = _mm_setzero_si128();
+  for (; x + 16 <= width; x += 16) {
+    __m128i g = _mm_loadu_si128((__m128i const *)(glyph_row + x));
+    __m128i m = _mm_loadu_si128((__m128i const *)(mark_row + x));
+    __m128i is_dot = _mm_cmpeq_epi8(g, dots);
+    __m128i is_awake = _mm_cmpeq_epi8(_mm_and_si128(m, busy), zero);
+    U32 live = (U32)_mm_movemask_epi8(_mm_andnot_si128(is_dot, is_awake));
+    if (live)
+      return x + (Usz)__builtin_ctz(live);
+  }
+#elif defined(ORCA_SIM_SCAN_NEON)
+  uint8x16_t const dots = vdupq_n_u8('.');
+  uint8x16_t const busy = vdupq_n_u8(Mark_flag_lock | Mark_flag_sleep);
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t g = vld1q_u8((U8 const *)(glyph_row + x));
+    uint8x16_t m = vld1q_u8(mark_row + x);
+    uint8x16_t is_dot = vceqq_u8(g, dots);
+    uint8x16_t is_busy = vtstq_u8(m, busy);
+    uint8x16_t live = vmvnq_u8(vorrq_u8(is_dot, is_busy));
+    // No movemask on NEON. Narrowing by 4 bits leaves one nibble per lane.
+    U64 nibbles = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(live), 4)), 0);
+    if (nibbles)
+      return x + (Usz)(__builtin_ctzll(nibbles) >> 2);
+  }
+#endif
+  for (; x < width; ++x) {
+    if (glyph_row[x] != '.' &&
+        !(mark_row[x] & (Mark_flag_lock | Mark_flag_sleep)))
+      return x;
+  }
+  return width;
+}
 
-  for (Usz iy = 0; iy < height; ++iy) {
-    Glyph const *glyph_row = gbuf + iy * width;
-    Mark const *mark_row = mbuf + iy * width;
-    for (Usz ix = 0; ix < width; ++ix) {
-      Glyph glyph_char = glyph_row[ix];
-      if (ORCA_LIKELY(glyph_char == '.'))
-        continue;
-      Mark cell_flags = mark_row[ix] & (Mark_flag_lock | Mark_flag_sleep);
-      if (cell_flags & (Mark_flag_lock | Mark_flag_sleep))
-        continue;
-      switch (glyph_char) {
+static ORCA_FORCEINLINE void run_cell(Glyph *restrict gbuf,
+                                      Mark *restrict mbuf, Usz height,
+                                      Usz width, Usz iy, Usz ix,
+                                      Usz tick_number,
+                                      Oper_extra_params *extras,
+                                      Glyph glyph_char) {
+  // Locked and sleeping cells are skipped by the callers.
+  Mark cell_flags = Mark_flag_none;
+#ifdef ORCA_SIM_TABLE_DISPATCH
+  Oper_behavior_fn behavior = oper_behavior_table[(U8)glyph_char];
+  if (behavior)
+    behavior(gbuf, mbuf, height, width, iy, ix, tick_number, extras,
+             cell_flags, glyph_char);
+#else
+  switch (glyph_char) {
 #define UNIQUE_CASE(_oper_char, _oper_name)                                    \
   case _oper_char:                                                             \
     oper_behavior_##_oper_name(gbuf, mbuf, height, width, iy, ix, tick_number, \
-                               &extras, cell_flags, glyph_char);               \
+                               extras, cell_flags, glyph_char);                \
     break;
 
 #define ALPHA_CASE(_upper_oper_char, _oper_name)                               \
   case _upper_oper_char:                                                       \
   case (char)(_upper_oper_char | 1 << 5):                                      \
     oper_behavior_##_oper_name(gbuf, mbuf, height, width, iy, ix, tick_number, \
-                               &extras, cell_flags, glyph_char);               \
+                               extras, cell_flags, glyph_char);                \
     break;
-        UNIQUE_OPERATORS(UNIQUE_CASE)
-        ALPHA_OPERATORS(ALPHA_CASE)
+    UNIQUE_OPERATORS(UNIQUE_CASE)
+    ALPHA_OPERATORS(ALPHA_CASE)
 #undef UNIQUE_CASE
 #undef ALPHA_CASE
+  }
+#endif
+}
+
+void orca_run(Orca_vm *vm, Glyph *restrict gbuf, Mark *restrict mbuf,
+              Usz height, Usz width, Usz tick_number, Oevent_list *oevent_list,
+              Usz random_seed) {
+  Glyph vars_slots[Glyphs_index_count];
+  memset(vars_slots, '.', sizeof(vars_slots));
+  Oper_extra_params extras;
+  extras.vars_slots = &vars_slots[0];
+  extras.oevent_list = oevent_list;
+  extras.random_seed = random_seed;
+  extras.vm = vm;
+  extras.oper_index = NULL;
+  extras.mark_only = false;
+  // Not kept up to date here, so the next orca_vm_run() has to rebuild it.
+  oper_index_invalidate(&vm->oper_index);
+
+  for (Usz iy = 0; iy < height; ++iy) {
+    Glyph const *glyph_row = gbuf + iy * width;
+    Mark const *mark_row = mbuf + iy * width;
+    for (Usz ix = 0;; ++ix) {
+      ix = next_live_cell(glyph_row, mark_row, ix, width);
+      if (ix == width)
+        break;
+      run_cell(gbuf, mbuf, height, width, iy, ix, tick_number, &extras,
+               glyph_row[ix]);
+    }
+  }
+}
+
+//////// Operator index
+
+void oper_index_init(Oper_index *oi) {
+  oi->bits = NULL;
+  oi->row_counts = NULL;
+  oi->height = 0;
+  oi->width = 0;
+  oi->words_per_row = 0;
+  oi->bits_capacity = 0;
+  oi->rows_capacity = 0;
+  oi->needs_rebuild = true;
+}
+
+void oper_index_deinit(Oper_index *oi) {
+  free(oi->bits);
+  free(oi->row_counts);
+}
+
+void oper_index_invalidate(Oper_index *oi) { oi->needs_rebuild = true; }
+
+void oper_index_rebuild(Oper_index *oi, Glyph const *gbuf, Usz height,
+                        Usz width) {
+  Usz words_per_row = (width + 63) / 64;
+  Usz words = height * words_per_row;
+  if (oi->bits_capacity < words) {
+    Usz cap = orca_round_up_power2(words);
+    oi->bits = realloc(oi->bits, cap * sizeof(U64));
+    oi->bits_capacity = cap;
+  }
+  if (oi->rows_capacity < height) {
+    Usz cap = orca_round_up_power2(height);
+    oi->row_counts = realloc(oi->row_counts, cap * sizeof(U32));
+    oi->rows_capacity = cap;
+  }
+  oi->height = height;
+  oi->width = width;
+  oi->words_per_row = words_per_row;
+  if (words)
+    memset(oi->bits, 0, words * sizeof(U64));
+  for (Usz iy = 0; iy < height; ++iy) {
+    Glyph const *glyph_row = gbuf + iy * width;
+    U64 *bits_row = oi->bits + iy * words_per_row;
+    U32 count = 0;
+    for (Usz ix = 0; ix < width; ++ix) {
+      if (!glyph_is_oper_table[(U8)glyph_row[ix]])
+        continue;
+      bits_row[ix >> 6] |= (U64)1 << (ix & 63);
+      ++count;
+    }
+    oi->row_counts[iy] = count;
+  }
+  oi->needs_rebuild = false;
+}
+
+void oper_index_update_cell(Oper_index *oi, Usz y, Usz x, Glyph g) {
+  if (oi->needs_rebuild || y >= oi->height || x >= oi->width)
+    return;
+  oper_index_note(oi, y, x, g);
+}
+
+void oper_index_update_rect(Oper_index *oi, Glyph const *gbuf, Usz height,
+                            Usz width, Usz y, Usz x, Usz rect_h, Usz rect_w) {
+  if (oi->needs_rebuild)
+    return;
+  if (oi->height != height || oi->width != width) {
+    oi->needs_rebuild = true;
+    return;
+  }
+  if (y >= height || x >= width)
+    return;
+  if (rect_h > height - y)
+    rect_h = height - y;
+  if (rect_w > width - x)
+    rect_w = width - x;
+  for (Usz iy = y, ey = y + rect_h; iy < ey; ++iy) {
+    Glyph const *glyph_row = gbuf + iy * width;
+    for (Usz ix = x, ex = x + rect_w; ix < ex; ++ix)
+      oper_index_note(oi, iy, ix, glyph_row[ix]);
+  }
+}
+
+#ifndef NDEBUG
+// Catches writes to the grid that didn't go through the index. Only used in
+// assertions -- it's as slow as the full scan that the index is avoiding.
+static bool oper_index_matches(Oper_index const *oi, Glyph const *gbuf) {
+  for (Usz iy = 0; iy < oi->height; ++iy) {
+    Glyph const *glyph_row = gbuf + iy * oi->width;
+    U64 const *bits_row = oi->bits + iy * oi->words_per_row;
+    U32 count = 0;
+    for (Usz ix = 0; ix < oi->width; ++ix) {
+      bool bit = bits_row[ix >> 6] >> (ix & 63) & 1;
+      if (bit != glyph_is_oper_table[(U8)glyph_row[ix]])
+        return false;
+      count += bit;
+    }
+    if (count != oi->row_counts[iy])
+      return false;
+  }
+  return true;
+}
+#endif
+
+static ORCA_FORCEINLINE Usz ctz64(U64 x) {
+  assert(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return (Usz)__builtin_ctzll(x);
+#else
+  Usz n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+//////// VM
+
+void orca_vm_init(Orca_vm *vm) {
+  oper_state_store_init(&vm->state_store);
+  oper_index_init(&vm->oper_index);
+  vm->midicc_interp = midicc_interp_create();
+}
+
+void orca_vm_deinit(Orca_vm *vm) {
+  oper_state_store_deinit(&vm->state_store);
+  oper_index_deinit(&vm->oper_index);
+  midicc_interp_destroy(vm->midicc_interp);
+}
+
+void orca_vm_reset(Orca_vm *vm) { oper_state_store_clear(&vm->state_store); }
+
+void orca_vm_reset_unique_random(Orca_vm *vm) {
+  Oper_state_store *ss = &vm->state_store;
+  for (Usz i = 0; i < ss->capacity; ++i) {
+    Oper_state_slot *s = &ss->slots[i];
+    if (s->oper_char == 'r')
+      s->state.unique_random.initialized = false;
+  }
+}
+
+// Runs the cells that the index says hold an operator, in the same order as
+// a full scan would.
+static void run_indexed(Oper_index const *oper_index, Glyph *restrict gbuf,
+                        Mark *restrict mbuf, Usz height, Usz width,
+                        Usz tick_number, Oper_extra_params *extras) {
+  Usz words_per_row = oper_index->words_per_row;
+  U32 const *row_counts = oper_index->row_counts;
+  for (Usz iy = 0; iy < height; ++iy) {
+    // Operators can write into rows and cells we haven't reached yet, so the
+    // counts and bits are read again each time instead of being cached.
+    if (row_counts[iy] == 0)
+      continue;
+    U64 const *bits_row = oper_index->bits + iy * words_per_row;
+    Glyph const *glyph_row = gbuf + iy * width;
+    Mark const *mark_row = mbuf + iy * width;
+    Usz ix = 0;
+    for (;;) {
+      Usz word_i = ix >> 6;
+      if (word_i >= words_per_row)
+        break;
+      U64 word = bits_row[word_i] & (~(U64)0 << (ix & 63));
+      while (!word) {
+        if (++word_i == words_per_row)
+          goto next_row;
+        word = bits_row[word_i];
       }
+      ix = word_i * 64 + ctz64(word);
+      if (!(mark_row[ix] & (Mark_flag_lock | Mark_flag_sleep)))
+        run_cell(gbuf, mbuf, height, width, iy, ix, tick_number, extras,
+                 glyph_row[ix]);
+      ++ix;
     }
+  next_row:;
   }
 }
+
+static void orca_vm_ensure_index(Orca_vm *vm, Glyph const *gbuf, Usz height,
+                                 Usz width) {
+  Oper_index *oper_index = &vm->oper_index;
+  if (oper_index->needs_rebuild || oper_index->height != height ||
+      oper_index->width != width)
+    oper_index_rebuild(oper_index, gbuf, height, width);
+  assert(oper_index_matches(oper_index, gbuf));
+}
+
+void orca_vm_run(Orca_vm *vm, Glyph *restrict gbuf, Mark *restrict mbuf,
+                 Usz height, Usz width, Usz tick_number,
+                 Oevent_list *oevent_list, Usz random_seed) {
+  orca_vm_ensure_index(vm, gbuf, height, width);
+  Glyph vars_slots[Glyphs_index_count];
+  memset(vars_slots, '.', sizeof(vars_slots));
+  Oper_extra_params extras;
+  extras.vars_slots = &vars_slots[0];
+  extras.oevent_list = oevent_list;
+  extras.random_seed = random_seed;
+  extras.vm = vm;
+  extras.oper_index = &vm->oper_index;
+  extras.mark_only = false;
+  run_indexed(&vm->oper_index, gbuf, mbuf, height, width, tick_number,
+              &extras);
+}
+
+void orca_mark(Orca_vm *vm, Glyph const *gbuf, Mark *mbuf, Usz height,
+               Usz width) {
+  orca_vm_ensure_index(vm, gbuf, height, width);
+  mbuffer_clear(mbuf, height, width);
+  Glyph vars_slots[Glyphs_index_count];
+  memset(vars_slots, '.', sizeof(vars_slots));
+  Oper_extra_params extras;
+  extras.vars_slots = &vars_slots[0];
+  extras.oevent_list = NULL;
+  extras.random_seed = 0;
+  extras.vm = vm;
+  extras.oper_index = &vm->oper_index;
+  extras.mark_only = true;
+  // Every operator returns at PORTS_DONE, before it could write to the grid,
+  // so the const is only cast away to fit the operator signature.
+  run_indexed(&vm->oper_index, (Glyph *)gbuf, mbuf, height, width, 0, &extras);
+}
@@ -2,16 +2,107 @@
 #include "base.h"
 #include "vmio.h"
 
-void orca_run(Glyph *restrict gbuffer, Mark *restrict mbuffer, Usz height,
-              Usz width, Usz tick_number, Oevent_list *oevent_list,
-              Usz random_seed);
+// State for the operators that have to remember something between ticks, like
+// the arpeggiator and the bouncer. Entries are keyed by the y/x of the
+// operator's cell (not by an offset into the grid buffer), so they stay with
+// their operator when the grid is resized. The table grows with the number of
+// these operators, not with the size of the grid -- entries for cells that no
+// longer hold their operator are dropped when it next needs to grow.
+typedef struct Oper_state_slot Oper_state_slot;
+
+typedef struct {
+  Oper_state_slot *slots;
+  Usz count, capacity;
+} Oper_state_store;
+
+void oper_state_store_init(Oper_state_store *ss);
+void oper_state_store_deinit(Oper_state_store *ss);
+// Forget the state of every operator, as if they were all just placed.
+void oper_state_store_clear(Oper_state_store *ss);
+
+// Tracks which cells of a grid hold an operator, so that a tick only has to
+// visit those instead of every cell in the grid. One bit per cell, plus a
+// count per row so that empty rows are skipped. orca_vm_run() keeps it up to
+// date with anything the VM writes. Anything else that writes to the grid
+// has to either call one of the update functions for the cells it wrote, or
+// invalidate the index so that it's rebuilt on the next run.
+typedef struct {
+  U64 *bits;
+  U32 *row_counts;
+  Usz height, width, words_per_row;
+  Usz bits_capacity, rows_capacity;
+  bool needs_rebuild;
+} Oper_index;
+
+void oper_index_init(Oper_index *oi);
+void oper_index_deinit(Oper_index *oi);
+void oper_index_invalidate(Oper_index *oi);
+void oper_index_rebuild(Oper_index *oi, Glyph const *gbuffer, Usz height,
+                        Usz width);
+void oper_index_update_cell(Oper_index *oi, Usz y, Usz x, Glyph g);
+void oper_index_update_rect(Oper_index *oi, Glyph const *gbuffer, Usz height,
+                            Usz width, Usz y, Usz x, Usz rect_h, Usz rect_w);
+
+typedef struct Midicc_interp Midicc_interp;
 
-// MIDI CC Interpolation functions
-void process_interpolated_midi_cc_event(Oevent_midi_cc_interpolated const *event, Usz tick_number);
-void advance_midi_cc_interpolations(double delta_time, Oevent_list *oevent_list);
+// Everything the VM keeps between ticks for one grid. Nothing in here is
+// shared with any other Orca_vm, so different grids can be run side by side,
+// or on different threads, as long as each has its own.
+typedef struct {
+  Oper_state_store state_store;
+  Oper_index oper_index;
+  Midicc_interp *midicc_interp;
+} Orca_vm;
+
+void orca_vm_init(Orca_vm *vm);
+void orca_vm_deinit(Orca_vm *vm);
+// Forget the state of every operator, as if the grid was just loaded. Pending
+// MIDI CC interpolations are kept.
+void orca_vm_reset(Orca_vm *vm);
+// Makes every lowercase 'r' start a freshly shuffled sequence on its next
+// bang. Each one keeps its own random stream, so the new order still differs
+// from the old one.
+void orca_vm_reset_unique_random(Orca_vm *vm);
+
+// Runs one tick. Only visits the cells that the VM's operator index says hold
+// an operator -- if something other than the VM writes to the grid between
+// ticks, it has to update or invalidate vm->oper_index (see above). The index
+// is rebuilt first if it was invalidated or if the grid size changed.
+void orca_vm_run(Orca_vm *vm, Glyph *restrict gbuffer, Mark *restrict mbuffer,
+                 Usz height, Usz width, Usz tick_number,
+                 Oevent_list *oevent_list, Usz random_seed);
+
+// Fills in the mark buffer with the ports, locks and stuns that the operators
+// in the grid have as it stands, for drawing a paused grid. Nothing else is
+// done: the grid isn't written to, no events are made, and no operator state
+// is read or changed, so it can be called as often as needed without changing
+// what the next orca_vm_run() does. Lowercase operators only get their ports
+// marked if there's already a bang next to them, and the outputs that send
+// events only when banged aren't marked. Uses and, if needed, rebuilds
+// vm->oper_index the same way orca_vm_run() does.
+void orca_mark(Orca_vm *vm, Glyph const *gbuffer, Mark *mbuffer, Usz height,
+               Usz width);
+
+// Same results as orca_vm_run(), but scans every cell instead of using the
+// index. vm->oper_index isn't used, and is invalidated.
+void orca_run(Orca_vm *vm, Glyph *restrict gbuffer, Mark *restrict mbuffer,
+              Usz height, Usz width, Usz tick_number, Oevent_list *oevent_list,
+              Usz random_seed);
 
-// BOORCH
-extern Usz last_random_unique;
-void reset_last_unique_value(void);
+// MIDI CC interpolation. An interpolated MIDI CC event from the VM starts a
+// ramp from the last value sent for its channel and control to its target,
+// lasting a number of ticks of tick_secs each. The ramps move with real time:
+// advance_midi_cc_interpolations() moves them along by delta_time seconds and
+// adds a MIDI CC event for each one whose value changed, so calling it more
+// often than once per tick gives smoother ramps.
+void process_interpolated_midi_cc_event(
+    Orca_vm *vm, Oevent_midi_cc_interpolated const *event, double tick_secs);
+void advance_midi_cc_interpolations(Orca_vm *vm, double delta_time,
+                                    Oevent_list *oevent_list);
+// True if any ramp is still moving.
+bool has_midi_cc_interpolations(Orca_vm const *vm);
+// Call with each MIDI CC sent directly, so that the next ramp for that channel
+// and control starts from it.
+void set_midi_cc_value(Orca_vm *vm, U8 channel, U8 control, U8 value);
 
 void midi_panic(Oevent_list *oevent_list);
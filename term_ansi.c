@@ -0,0 +1,413 @@
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700 // for wcwidth()
+#endif
+#include "term_ansi.h"
+#include <errno.h>
+#include <stdio.h>
+#include <wchar.h>
+
+enum { Term_ansi_unknown = -1 };
+
+// Room for the worst case of one cell: moving the cursor, a full change of
+// SGR attributes, and a multibyte character.
+enum { Term_ansi_cell_max_bytes = 96 };
+
+void term_ansi_init(Term_ansi *ta, int fd) {
+  ta->cells = NULL;
+  ta->line = NULL;
+  ta->out = NULL;
+  ta->out_len = ta->out_cap = 0;
+  ta->rows = ta->cols = 0;
+  ta->win_y = ta->win_x = 0;
+  ta->cur_y = ta->cur_x = Term_ansi_unknown;
+  ta->pen = (Term_ansi_cell){.ch = 0, .attrs = 0, .fg = -1, .bg = -1};
+  for (Usz i = 0; i < 128; ++i)
+    ta->acs[i] = (U32)i;
+  memset(ta->pair_known, 0, sizeof ta->pair_known);
+  ta->fd = fd;
+  ta->is_valid = false;
+}
+
+void term_ansi_deinit(Term_ansi *ta) {
+  free(ta->cells);
+  free(ta->line);
+  free(ta->out);
+}
+
+void term_ansi_invalidate(Term_ansi *ta) { ta->is_valid = false; }
+
+static bool term_ansi_write_all(int fd, char const *buf, Usz len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return false;
+    }
+    buf += n;
+    len -= (Usz)n;
+  }
+  return true;
+}
+
+bool term_ansi_flush(Term_ansi *ta) {
+  if (ta->out_len == 0)
+    return true;
+  // In case curses has anything of its own still buffered.
+  fflush(stdout);
+  bool ok = term_ansi_write_all(ta->fd, ta->out, ta->out_len);
+  ta->out_len = 0;
+  return ok;
+}
+
+static void term_ansi_reserve(Term_ansi *ta, Usz count) {
+  if (ta->out_cap - ta->out_len >= count)
+    return;
+  // Grown instead of flushed, so that the terminal never shows half a frame.
+  Usz cap = ta->out_cap * 2;
+  if (cap < ta->out_len + count)
+    cap = ta->out_len + count;
+  ta->out = realloc(ta->out, cap);
+  ta->out_cap = cap;
+}
+
+static void term_ansi_puts(Term_ansi *ta, char const *s, Usz len) {
+  memcpy(ta->out + ta->out_len, s, len);
+  ta->out_len += len;
+}
+
+static void term_ansi_putc(Term_ansi *ta, char c) {
+  ta->out[ta->out_len++] = c;
+}
+
+static void term_ansi_putu(Term_ansi *ta, unsigned n) {
+  char buf[16];
+  Usz i = sizeof buf;
+  do {
+    buf[--i] = (char)('0' + n % 10);
+    n /= 10;
+  } while (n > 0);
+  term_ansi_puts(ta, buf + i, sizeof buf - i);
+}
+
+// One SGR parameter, with the separator it needs if it isn't the first.
+static void term_ansi_param(Term_ansi *ta, bool *is_first, unsigned n) {
+  if (!*is_first)
+    term_ansi_putc(ta, ';');
+  *is_first = false;
+  term_ansi_putu(ta, n);
+}
+
+static void term_ansi_color_param(Term_ansi *ta, bool *is_first, I16 color,
+                                  unsigned base) {
+  if (color < 0) {
+    term_ansi_param(ta, is_first, base + 9);
+  } else if (color < 8) {
+    term_ansi_param(ta, is_first, base + (unsigned)color);
+  } else {
+    term_ansi_param(ta, is_first, base + 8);
+    term_ansi_param(ta, is_first, 5);
+    term_ansi_param(ta, is_first, (unsigned)color);
+  }
+}
+
+// Changes the SGR state to the cell's, with as few parameters as it takes.
+static void term_ansi_set_pen(Term_ansi *ta, Term_ansi_cell const *c) {
+  Term_ansi_cell *pen = &ta->pen;
+  U8 attrs = c->attrs;
+  if (pen->attrs == attrs && pen->fg == c->fg && pen->bg == c->bg)
+    return;
+  bool is_first = true;
+  term_ansi_puts(ta, "\x1b[", 2);
+  U8 off = pen->attrs & (U8)~attrs;
+  U8 now = pen->attrs;
+  // Bold and dim are turned off together.
+  if (off & (Term_ansi_attr_bold | Term_ansi_attr_dim)) {
+    term_ansi_param(ta, &is_first, 22);
+    now &= (U8)~(Term_ansi_attr_bold | Term_ansi_attr_dim);
+  }
+  if (off & Term_ansi_attr_underline)
+    term_ansi_param(ta, &is_first, 24);
+  if (off & Term_ansi_attr_blink)
+    term_ansi_param(ta, &is_first, 25);
+  if (off & Term_ansi_attr_reverse)
+    term_ansi_param(ta, &is_first, 27);
+  if (off & Term_ansi_attr_invis)
+    term_ansi_param(ta, &is_first, 28);
+  now &= attrs;
+  U8 on = attrs & (U8)~now;
+  if (on & Term_ansi_attr_bold)
+    term_ansi_param(ta, &is_first, 1);
+  if (on & Term_ansi_attr_dim)
+    term_ansi_param(ta, &is_first, 2);
+  if (on & Term_ansi_attr_underline)
+    term_ansi_param(ta, &is_first, 4);
+  if (on & Term_ansi_attr_blink)
+    term_ansi_param(ta, &is_first, 5);
+  if (on & Term_ansi_attr_reverse)
+    term_ansi_param(ta, &is_first, 7);
+  if (on & Term_ansi_attr_invis)
+    term_ansi_param(ta, &is_first, 8);
+  if (pen->fg != c->fg)
+    term_ansi_color_param(ta, &is_first, c->fg, 30);
+  if (pen->bg != c->bg)
+    term_ansi_color_param(ta, &is_first, c->bg, 40);
+  term_ansi_putc(ta, 'm');
+  pen->attrs = attrs;
+  pen->fg = c->fg;
+  pen->bg = c->bg;
+}
+
+static U8 term_ansi_attrs_of(attr_t a) {
+  U8 attrs = 0;
+  if (a & A_BOLD)
+    attrs |= Term_ansi_attr_bold;
+  if (a & A_DIM)
+    attrs |= Term_ansi_attr_dim;
+  if (a & A_UNDERLINE)
+    attrs |= Term_ansi_attr_underline;
+  if (a & A_BLINK)
+    attrs |= Term_ansi_attr_blink;
+  if (a & (A_REVERSE | A_STANDOUT))
+    attrs |= Term_ansi_attr_reverse;
+  if (a & A_INVIS)
+    attrs |= Term_ansi_attr_invis;
+  return attrs;
+}
+
+// The glyph for a VT100 alternate charset character, like the ones in
+// ACS_BULLET and the other ACS_ constants, as Unicode or as the ASCII that
+// curses falls back to.
+static U32 term_ansi_acs_glyph(U32 c, bool unicode) {
+  U32 u, a;
+  switch (c) { // clang-format off
+  case '`': u = 0x25C6, a = '+'; break; // Diamond
+  case 'a': u = 0x2592, a = ':'; break; // Checker board
+  case 'f': u = 0x00B0, a = '\''; break; // Degree
+  case 'g': u = 0x00B1, a = '#'; break; // Plus/minus
+  case 'h': u = 0x2591, a = '#'; break; // Board of squares
+  case 'j': u = 0x2518, a = '+'; break; // Lower right corner
+  case 'k': u = 0x2510, a = '+'; break; // Upper right corner
+  case 'l': u = 0x250C, a = '+'; break; // Upper left corner
+  case 'm': u = 0x2514, a = '+'; break; // Lower left corner
+  case 'n': u = 0x253C, a = '+'; break; // Plus
+  case 'q': u = 0x2500, a = '-'; break; // Horizontal line
+  case 't': u = 0x251C, a = '+'; break; // Left tee
+  case 'u': u = 0x2524, a = '+'; break; // Right tee
+  case 'v': u = 0x2534, a = '+'; break; // Bottom tee
+  case 'w': u = 0x252C, a = '+'; break; // Top tee
+  case 'x': u = 0x2502, a = '|'; break; // Vertical line
+  case '~': u = 0x00B7, a = 'o'; break; // Bullet
+  default: return c;
+  } // clang-format on
+  return unicode ? u : a;
+}
+
+// Colors of a color pair. Asking curses is slow enough to show up when it's
+// done for every cell, so the first 256 pairs are only asked about once.
+static void term_ansi_pair_colors(Term_ansi *ta, short pair, I16 *fg,
+                                  I16 *bg) {
+  if (pair >= 0 && pair < 256 && (ta->pair_known[pair / 8] & 1 << pair % 8)) {
+    *fg = ta->pair_fg[pair];
+    *bg = ta->pair_bg[pair];
+    return;
+  }
+  short f, b;
+  if (pair_content(pair, &f, &b) == ERR)
+    f = b = -1;
+  *fg = f;
+  *bg = b;
+  if (pair >= 0 && pair < 256) {
+    ta->pair_fg[pair] = f;
+    ta->pair_bg[pair] = b;
+    ta->pair_known[pair / 8] |= (U8)(1 << pair % 8);
+  }
+}
+
+static void term_ansi_put_cell(Term_ansi *ta, int y, int x,
+                               Term_ansi_cell const *c) {
+  term_ansi_reserve(ta, Term_ansi_cell_max_bytes);
+  if (ta->cur_y != y || ta->cur_x != x) {
+    term_ansi_puts(ta, "\x1b[", 2);
+    term_ansi_putu(ta, (unsigned)y + 1);
+    term_ansi_putc(ta, ';');
+    term_ansi_putu(ta, (unsigned)x + 1);
+    term_ansi_putc(ta, 'H');
+  }
+  term_ansi_set_pen(ta, c);
+  if (c->ch < 0x80) {
+    term_ansi_putc(ta, (char)c->ch);
+  } else {
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof mbs);
+    size_t n = wcrtomb(ta->out + ta->out_len, (wchar_t)c->ch, &mbs);
+    if (n == (size_t)-1)
+      term_ansi_putc(ta, '?');
+    else
+      ta->out_len += n;
+  }
+  ta->cur_y = y;
+  ta->cur_x = x + 1;
+  // Don't count on where the cursor goes after the last column.
+  if (ta->cur_x >= COLS)
+    ta->cur_x = Term_ansi_unknown;
+}
+
+// Makes room for a window of this size at this position on the screen, and
+// queues clearing the screen.
+static void term_ansi_reset(Term_ansi *ta, int win_y, int win_x, int rows,
+                            int cols) {
+  Usz count = (Usz)rows * (Usz)cols;
+  if (rows != ta->rows || cols != ta->cols) {
+    ta->cells = realloc(ta->cells, count * sizeof(Term_ansi_cell));
+    ta->line = realloc(ta->line, ((Usz)cols + 1) * sizeof(cchar_t));
+    // Enough for a typical frame, where most cells haven't changed. Frames
+    // that need more grow it.
+    term_ansi_reserve(ta, count * 4 + 4096);
+  }
+  // The screen is cleared to blanks with the default colors, so that's what
+  // doesn't need writing again.
+  for (Usz i = 0; i < count; ++i)
+    ta->cells[i] = (Term_ansi_cell){.ch = ' ', .attrs = 0, .fg = -1, .bg = -1};
+  ta->rows = rows;
+  ta->cols = cols;
+  ta->win_y = win_y;
+  ta->win_x = win_x;
+  mbstate_t mbs;
+  memset(&mbs, 0, sizeof mbs);
+  char mb[MB_LEN_MAX];
+  bool has_unicode = wcrtomb(mb, (wchar_t)0x2500, &mbs) != (size_t)-1;
+  for (U32 i = 0; i < 128; ++i)
+    ta->acs[i] = term_ansi_acs_glyph(i, has_unicode);
+  // The colors could have been changed while we weren't drawing.
+  memset(ta->pair_known, 0, sizeof ta->pair_known);
+  term_ansi_reserve(ta, 16);
+  term_ansi_puts(ta, "\x1b[0m\x1b[2J", 8);
+  ta->pen = (Term_ansi_cell){.ch = 0, .attrs = 0, .fg = -1, .bg = -1};
+  ta->is_valid = true;
+}
+
+bool term_ansi_begin(Term_ansi *ta, WINDOW *win) {
+  int win_y, win_x, rows, cols;
+  getbegyx(win, win_y, win_x);
+  getmaxyx(win, rows, cols);
+  if (rows < 0)
+    rows = 0;
+  if (cols < 0)
+    cols = 0;
+  bool is_same = ta->is_valid && rows == ta->rows && cols == ta->cols &&
+                 win_y == ta->win_y && win_x == ta->win_x;
+  if (!is_same)
+    term_ansi_reset(ta, win_y, win_x, rows, cols);
+  // Something other than us might have moved it since the last frame.
+  ta->cur_y = ta->cur_x = Term_ansi_unknown;
+  return is_same;
+}
+
+// Writes the cell at y, x in the window if it isn't already on screen.
+static void term_ansi_set(Term_ansi *ta, int y, int x,
+                          Term_ansi_cell const *c) {
+  Term_ansi_cell *old = ta->cells + (Usz)y * (Usz)ta->cols + (Usz)x;
+  if (old->ch == c->ch && old->attrs == c->attrs && old->fg == c->fg &&
+      old->bg == c->bg)
+    return;
+  *old = *c;
+  term_ansi_put_cell(ta, ta->win_y + y, ta->win_x + x, c);
+}
+
+// Clips a run of count cells at y, x to the window. Returns how many are left.
+static int term_ansi_clip(Term_ansi const *ta, int y, int *x, int count) {
+  if (y < 0 || y >= ta->rows || *x >= ta->cols)
+    return 0;
+  if (*x < 0) {
+    count += *x;
+    *x = 0;
+  }
+  if (count > ta->cols - *x)
+    count = ta->cols - *x;
+  return count;
+}
+
+void term_ansi_put_chtypes(Term_ansi *ta, int y, int x, chtype const *chs,
+                           int count) {
+  count = term_ansi_clip(ta, y, &x, count);
+  // Runs of cells tend to share their attributes, so the colors are only
+  // looked up again when the pair changes.
+  short last_pair = -1;
+  I16 fg = -1, bg = -1;
+  for (int i = 0; i < count; ++i) {
+    chtype ch = chs[i];
+    Term_ansi_cell c;
+    c.ch = (U32)(ch & A_CHARTEXT);
+    if (ch & A_ALTCHARSET)
+      c.ch = ta->acs[c.ch & 0x7F];
+    else if (c.ch >= 0x80 || c.ch < 0x20)
+      c.ch = '?';
+    c.attrs = term_ansi_attrs_of(ch & A_ATTRIBUTES);
+    short pair = (short)PAIR_NUMBER(ch);
+    if (pair != last_pair) {
+      term_ansi_pair_colors(ta, pair, &fg, &bg);
+      last_pair = pair;
+    }
+    c.fg = fg;
+    c.bg = bg;
+    term_ansi_set(ta, y, x + i, &c);
+  }
+}
+
+void term_ansi_clear(Term_ansi *ta, int y, int x, int count) {
+  count = term_ansi_clip(ta, y, &x, count);
+  if (count <= 0)
+    return;
+  Term_ansi_cell c;
+  c.ch = ' ';
+  c.attrs = 0;
+  term_ansi_pair_colors(ta, 0, &c.fg, &c.bg);
+  for (int i = 0; i < count; ++i)
+    term_ansi_set(ta, y, x + i, &c);
+}
+
+void term_ansi_copy_lines(Term_ansi *ta, WINDOW *win, int y, int count) {
+  int cols = ta->cols;
+  if (y < 0) {
+    count += y;
+    y = 0;
+  }
+  if (count > ta->rows - y)
+    count = ta->rows - y;
+  for (int end = y + count; y < end; ++y) {
+    if (mvwin_wchnstr(win, y, 0, ta->line, cols) == ERR)
+      continue;
+    Term_ansi_cell *row = ta->cells + (Usz)y * (Usz)cols;
+    short last_pair = -1;
+    I16 fg = -1, bg = -1;
+    for (int x = 0; x < cols; ++x) {
+      wchar_t wch[CCHARW_MAX + 1];
+      attr_t a;
+      short pair;
+      if (getcchar(&ta->line[x], wch, &a, &pair, NULL) == ERR)
+        continue;
+      Term_ansi_cell c;
+      c.ch = wch[0] > 0 ? (U32)wch[0] : ' ';
+      if ((a & A_ALTCHARSET) && c.ch < 0x80)
+        c.ch = ta->acs[c.ch];
+      c.attrs = term_ansi_attrs_of(a);
+      if (pair != last_pair) {
+        term_ansi_pair_colors(ta, pair, &fg, &bg);
+        last_pair = pair;
+      }
+      c.fg = fg;
+      c.bg = bg;
+      int width = c.ch < 0x80 ? 1 : wcwidth((wchar_t)c.ch);
+      if (width < 1)
+        c.ch = '?', width = 1;
+      term_ansi_set(ta, y, x, &c);
+      // The cell after a double width character is covered by it.
+      if (width == 2 && x + 1 < cols) {
+        ++x;
+        row[x] = c;
+        ta->cur_x = Term_ansi_unknown;
+      }
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "base.h"
+#include <ncurses.h>
+
+// Draws a curses window to the terminal by writing ANSI escape sequences
+// itself, instead of going through wnoutrefresh() and doupdate(). It keeps its
+// own copy of what's on the screen, writes only the cells that differ from it,
+// and changes the SGR attributes only where they differ from the cell written
+// before. A frame goes out with a single write().
+//
+// Cells can be given to it as chtypes, the same as for waddchnstr(), which
+// skips curses entirely. Lines that were drawn on with other curses calls can
+// be copied out of the window instead.
+//
+// Assumes an xterm-like terminal that understands 8 or 256 colors. Alternate
+// charset glyphs (ACS_BULLET and the box drawing characters) are written as
+// their Unicode equivalents if the locale can encode them, and as ASCII if not.
+//
+// Curses doesn't know about anything written this way. Going back to drawing
+// with curses needs clearok(curscr, TRUE) and the whole window drawn again,
+// and coming back from it needs term_ansi_invalidate().
+
+typedef enum {
+  Term_ansi_attr_bold = 1 << 0,
+  Term_ansi_attr_dim = 1 << 1,
+  Term_ansi_attr_underline = 1 << 2,
+  Term_ansi_attr_blink = 1 << 3,
+  Term_ansi_attr_reverse = 1 << 4,
+  Term_ansi_attr_invis = 1 << 5,
+} Term_ansi_attr;
+
+typedef struct {
+  U32 ch;   // Code point
+  U8 attrs; // Term_ansi_attr flags
+  I16 fg;   // Color number, or -1 for the terminal's default
+  I16 bg;
+} Term_ansi_cell;
+
+typedef struct {
+  Term_ansi_cell *cells; // What's on the screen, rows * cols
+  cchar_t *line;         // Scratch for reading back a line of the window
+  char *out;             // The frame being written. Grows to fit
+  Usz out_len, out_cap;
+  int rows, cols;        // Of the window that was drawn last
+  int win_y, win_x;      // Where on the screen it was
+  int cur_y, cur_x;      // Terminal cursor, or -1 if not known
+  Term_ansi_cell pen;    // Current SGR state. ch is unused
+  U32 acs[128];          // What to write for each A_ALTCHARSET character
+  I16 pair_fg[256];      // Colors of the first color pairs, looked up once
+  I16 pair_bg[256];
+  U8 pair_known[256 / 8];
+  int fd;
+  bool is_valid;
+} Term_ansi;
+
+void term_ansi_init(Term_ansi *ta, int fd);
+void term_ansi_deinit(Term_ansi *ta);
+// The next frame clears the screen and writes every cell.
+void term_ansi_invalidate(Term_ansi *ta);
+// Starts a frame for a window. Returns false if the screen was cleared for it,
+// because it's a different size or in a different place than last time, or
+// because of term_ansi_invalidate(). Every cell of the window has to be
+// written in that case.
+bool term_ansi_begin(Term_ansi *ta, WINDOW *win);
+// Like waddchnstr(), with y and x in the window, but goes to the terminal.
+void term_ansi_put_chtypes(Term_ansi *ta, int y, int x, chtype const *chs,
+                           int count);
+// Like wclrtoeol(), but only for count cells.
+void term_ansi_clear(Term_ansi *ta, int y, int x, int count);
+// Copies count lines of the window, starting at line y, to the terminal.
+void term_ansi_copy_lines(Term_ansi *ta, WINDOW *win, int y, int count);
+// Writes out the frame. Returns false if the write failed.
+bool term_ansi_flush(Term_ansi *ta);
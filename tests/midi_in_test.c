@@ -0,0 +1,163 @@
+// Checks the MIDI clock input's PLL against synthetic pulses, and the ring
+// that passes clock events between threads. Run by 'tool test'.
+#include "../midi_in.h"
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);                              \
+      printf(__VA_ARGS__);                                                     \
+      putchar('\n');                                                           \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+// Same numbers on every run, so that a failure can be reproduced.
+static U32 test_rand_state = 1;
+static U32 test_rand(void) {
+  test_rand_state = test_rand_state * UINT32_C(1664525) + UINT32_C(1013904223);
+  return test_rand_state >> 8;
+}
+// Uniform in -jitter..jitter nanoseconds.
+static I64 test_jitter(I64 jitter) {
+  return (I64)(test_rand() % (U32)(jitter * 2 + 1)) - jitter;
+}
+
+// Feeds the PLL pulses at the given tempo, each one arriving up to jitter
+// nanoseconds early or late, and checks how far the corrected times are from
+// the real ones once the loop has had settle_pulses to lock on.
+static void test_pll_jitter(double bpm, I64 jitter, Usz settle_pulses,
+                            I64 max_err) {
+  Midi_clock_pll pll;
+  midi_clock_pll_reset(&pll);
+  double period = 60e9 / (bpm * 24.0);
+  U64 start = UINT64_C(1000000000);
+  I64 worst = 0;
+  Usz pulses = settle_pulses + 24 * 64;
+  for (Usz i = 0; i < pulses; ++i) {
+    U64 ideal = start + (U64)(period * (double)i);
+    U64 arrival = (U64)((I64)ideal + test_jitter(jitter));
+    U64 got = midi_clock_pll_pulse(&pll, arrival);
+    if (i < settle_pulses)
+      continue;
+    I64 err = (I64)(got - ideal);
+    if (err < 0)
+      err = -err;
+    if (err > worst)
+      worst = err;
+  }
+  CHECK(worst <= max_err,
+        "%.0f BPM, +/-%.1f ms jitter: pulse off by %.3f ms, want <= %.3f ms",
+        bpm, (double)jitter / 1e6, (double)worst / 1e6, (double)max_err / 1e6);
+  double got_bpm = midi_clock_pll_bpm(&pll);
+  CHECK(got_bpm > bpm - 0.5 && got_bpm < bpm + 0.5,
+        "%.0f BPM, +/-%.1f ms jitter: tempo is %.2f BPM", bpm,
+        (double)jitter / 1e6, got_bpm);
+}
+
+// A tempo ramp from one tempo to another over ramp_beats, with jitter. The
+// corrected times lag behind while it's ramping, but shouldn't lose the beat,
+// and the tempo should catch up once it's steady again.
+static void test_pll_ramp(double from_bpm, double to_bpm, Usz ramp_beats,
+                          I64 jitter, I64 max_err) {
+  Midi_clock_pll pll;
+  midi_clock_pll_reset(&pll);
+  Usz settle_pulses = 24 * 8, ramp_pulses = 24 * ramp_beats;
+  Usz pulses = settle_pulses + ramp_pulses + 24 * 16;
+  double ideal = 1e9;
+  I64 worst = 0;
+  for (Usz i = 0; i < pulses; ++i) {
+    double bpm = from_bpm;
+    if (i >= settle_pulses + ramp_pulses)
+      bpm = to_bpm;
+    else if (i >= settle_pulses)
+      bpm += (to_bpm - from_bpm) * (double)(i - settle_pulses) /
+             (double)ramp_pulses;
+    if (i > 0)
+      ideal += 60e9 / (bpm * 24.0);
+    U64 arrival = (U64)((I64)ideal + test_jitter(jitter));
+    U64 got = midi_clock_pll_pulse(&pll, arrival);
+    if (i < settle_pulses)
+      continue;
+    I64 err = (I64)got - (I64)ideal;
+    if (err < 0)
+      err = -err;
+    if (err > worst)
+      worst = err;
+  }
+  CHECK(worst <= max_err,
+        "%.0f to %.0f BPM: pulse off by %.3f ms, want <= %.3f ms", from_bpm,
+        to_bpm, (double)worst / 1e6, (double)max_err / 1e6);
+  double got_bpm = midi_clock_pll_bpm(&pll);
+  CHECK(got_bpm > to_bpm - 0.5 && got_bpm < to_bpm + 0.5,
+        "%.0f to %.0f BPM: tempo is %.2f BPM", from_bpm, to_bpm, got_bpm);
+}
+
+static void test_pll_restart(void) {
+  Midi_clock_pll pll;
+  midi_clock_pll_reset(&pll);
+  CHECK(midi_clock_pll_bpm(&pll) == 0.0, "tempo known before any pulses");
+  U64 t = 1000;
+  CHECK(midi_clock_pll_pulse(&pll, t) == t, "first pulse was moved");
+  CHECK(midi_clock_pll_bpm(&pll) == 0.0, "tempo known after one pulse");
+  // 120 BPM is 20.833 ms per pulse.
+  U64 period = UINT64_C(20833333);
+  for (Usz i = 0; i < 48; ++i)
+    midi_clock_pll_pulse(&pll, t += period);
+  // A pause of a few pulses starts over from the pulse after it, instead of
+  // dragging the corrected times along from where they were.
+  t += period * 5;
+  CHECK(midi_clock_pll_pulse(&pll, t) == t, "pulse after a pause was moved");
+  CHECK(midi_clock_pll_bpm(&pll) == 0.0, "tempo kept across a pause");
+}
+
+static void test_ring(void) {
+  static Midi_clock_ring ring;
+  midi_clock_ring_init(&ring);
+  Midi_clock_event ev = {0};
+  ev.type = Midi_clock_event_pulse;
+  Usz pushed = 0;
+  for (Usz i = 0; i < MIDI_CLOCK_RING_SIZE + 10; ++i) {
+    ev.time = i;
+    if (midi_clock_ring_push(&ring, &ev))
+      ++pushed;
+  }
+  CHECK(pushed == MIDI_CLOCK_RING_SIZE, "pushed %zu into a full ring",
+        (size_t)pushed);
+  // Pop in uneven amounts, pushing more in between, so that the indices wrap.
+  Midi_clock_event out[100];
+  U64 want = 0;
+  for (Usz round = 0; round < 20; ++round) {
+    Usz n = midi_clock_ring_pop(&ring, out, 37);
+    for (Usz i = 0; i < n; ++i, ++want)
+      CHECK(out[i].time == want, "popped %llu, want %llu",
+            (unsigned long long)out[i].time, (unsigned long long)want);
+    for (Usz i = 0; i < 30; ++i) {
+      ev.time = pushed;
+      if (midi_clock_ring_push(&ring, &ev))
+        ++pushed;
+    }
+  }
+  while (midi_clock_ring_pop(&ring, out, 100)) {
+  }
+  CHECK(midi_clock_ring_pop(&ring, out, 100) == 0, "empty ring popped");
+}
+
+int main(void) {
+  // Steady clocks, like from a DAW over a USB interface.
+  test_pll_jitter(120.0, 2000000, 24 * 8, 1000000);
+  test_pll_jitter(174.0, 2000000, 24 * 8, 1000000);
+  test_pll_jitter(60.0, 2000000, 24 * 8, 1000000);
+  // No jitter shouldn't mean any error, past rounding.
+  test_pll_jitter(120.0, 0, 24, 1000);
+  // Speeding up and slowing down over four bars. It lags behind a ramp by a
+  // few milliseconds, which is the price of smoothing over the jitter.
+  test_pll_ramp(120.0, 140.0, 16, 2000000, 5000000);
+  test_pll_ramp(140.0, 120.0, 16, 2000000, 5000000);
+  test_pll_restart();
+  test_ring();
+  return failures ? 1 : 0;
+}
@@ -1,34 +1,30 @@
 #include "base.h"
 #include "field.h"
 #include "gbuffer.h"
+#include "midi_in.h"
+#include "midi_out.h"
 #include "osc_out.h"
 #include "oso.h"
 #include "sim.h"
 #include "sysmisc.h"
+#include "term_ansi.h"
 #include "term_util.h"
 #include "tooltips.h"
 #include "vmio.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <locale.h>
-
-#define SOKOL_IMPL
-#include "sokol_time.h"
-#undef SOKOL_IMPL
-
-#ifdef FEAT_PORTMIDI
-#include <portmidi.h>
-#endif
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #if NCURSES_VERSION_PATCH < 20081122
 int _nc_has_mouse(void);
 #define has_mouse _nc_has_mouse
 #endif
 
-#define TIME_DEBUG 0
-#if TIME_DEBUG
-static int spin_track_timeout = 0;
-#endif
-
 #define staticni ORCA_NOINLINE static
 
 staticni void usage(void) { // clang-format off
@@ -45,12 +41,35 @@ fprintf(stderr,
 "                           Default: 120\n"
 "    --seed <number>        Set the seed for the random function.\n"
 "                           Default: 1\n"
+"    --no-render            Don't draw anything after starting up. For\n"
+"                           running headless, with only the MIDI and OSC\n"
+"                           output. Ctrl+Q still quits.\n"
 "    -h or --help           Print this message and exit.\n"
 "\n"
 "OSC/MIDI options:\n"
 "    --strict-timing\n"
 "        Attempt to reduce timing jitter of outgoing MIDI and OSC\n"
-"        messages. Uses more CPU time. May have no effect.\n"
+"        messages by running the clock with real-time (SCHED_FIFO)\n"
+"        scheduling. Needs permission to use real-time priority, for\n"
+"        example an rtprio limit. May have no effect.\n"
+"\n"
+"    --cc-rate <hz>\n"
+"        How many times per second to send the MIDI CC ramps started by\n"
+"        the ! operator. Only values that changed are sent. 0 moves them\n"
+"        only on each step, or on each MIDI clock if that's being sent.\n"
+"        Default: 1000\n"
+"\n"
+"    --midi-latency <ms>\n"
+"        Schedule PortMidi output this many milliseconds ahead of when\n"
+"        it's due, so that timing jitter comes from the MIDI driver\n"
+"        instead of from orca. 0 sends everything immediately.\n"
+"        Default: 1\n"
+"\n"
+"    --osc-lookahead <ms>\n"
+"        Time-tag each step's OSC bundle with when the step was due plus\n"
+"        this many milliseconds, so that a receiver like SuperCollider can\n"
+"        schedule it exactly. The receiver's clock has to agree with this\n"
+"        machine's. Without this option, bundles are handled on arrival.\n"
 "\n"
 "    --osc-midi-bidule <path>\n"
 "        Set MIDI to be sent via OSC formatted for Plogue Bidule.\n"
@@ -90,6 +109,8 @@ static Glyph_class glyph_class_of(Glyph glyph) {
   case '=':
   case '%':
   case '?':
+  case '^':
+  case '|':
   case '&':
     return Glyph_class_lowercase;
   case '$':
@@ -548,33 +569,194 @@ staticni void draw_hud(WINDOW *win, int win_y, int win_x, int height, int width,
   }
 }
 
-staticni void draw_glyphs_grid(WINDOW *win, int draw_y, int draw_x, int draw_h,
-                               int draw_w, Glyph const *restrict gbuffer,
+// What the grid area of the window held after it was last drawn, so that the
+// next draw only has to write the cells that changed since. Lines of the window
+// that nothing was written to are skipped by curses when it works out what to
+// send to the terminal, which is most of the cost of a frame over a slow link.
+//
+// Anything else that draws over the grid area has to mark the rows it drew on
+// with grid_drawn_mark_stale(), so that they get cleared and drawn in full.
+//
+// When drawing with Term_ansi, the grid goes straight to the terminal instead
+// of into the window. Only the rows that are about to be drawn over with curses
+// (marked with grid_drawn_mark_overlay()) are drawn into the window, so that
+// they can be copied out of it afterwards.
+enum { Cell_marks_count = Mark_flag_sleep << 1 };
+typedef struct {
+  Glyph *gbuffer; // The visible cells as they were drawn, rows * cols
+  Mark *mbuffer;
+  U8 *stale_rows;   // One for each row of the window above draw_h
+  U8 *overlay_rows; // Likewise. Only used with Term_ansi
+  Usz cells_cap, rows_cap;
+  // What to draw for each glyph and mark: the glyph (or the dot glyph, for
+  // '.') with term_attrs_of_cell(). Rulers are drawn over it afterwards.
+  chtype cell_chtypes[256][Cell_marks_count];
+  chtype cell_dot; // What cell_chtypes was made with. 0 if not made yet
+  // What the cells were drawn with. If any of it changes, the whole window is
+  // erased and drawn again.
+  Usz field_h, field_w, ruler_spacing_y, ruler_spacing_x;
+  int scroll_y, scroll_x, draw_h, draw_w;
+  bool use_fancy_dots, use_fancy_rulers;
+  bool is_valid;
+} Grid_drawn;
+
+static void grid_drawn_init(Grid_drawn *gd) {
+  gd->gbuffer = NULL;
+  gd->mbuffer = NULL;
+  gd->stale_rows = NULL;
+  gd->overlay_rows = NULL;
+  gd->cells_cap = gd->rows_cap = 0;
+  gd->cell_dot = 0;
+  gd->is_valid = false;
+}
+
+static void grid_drawn_deinit(Grid_drawn *gd) {
+  free(gd->gbuffer);
+  free(gd->mbuffer);
+  free(gd->stale_rows);
+  free(gd->overlay_rows);
+}
+
+// Returns false if the window has to be erased before drawing, because the
+// grid is being drawn differently than last time (or the window was cleared
+// since then.) After that, every row is stale.
+staticni bool grid_drawn_begin(Grid_drawn *gd, Usz field_h, Usz field_w,
+                               int scroll_y, int scroll_x, int draw_h,
+                               int draw_w, Usz ruler_spacing_y,
+                               Usz ruler_spacing_x, bool use_fancy_dots,
+                               bool use_fancy_rulers) {
+  if (gd->is_valid && gd->field_h == field_h && gd->field_w == field_w &&
+      gd->scroll_y == scroll_y && gd->scroll_x == scroll_x &&
+      gd->draw_h == draw_h && gd->draw_w == draw_w &&
+      gd->ruler_spacing_y == ruler_spacing_y &&
+      gd->ruler_spacing_x == ruler_spacing_x &&
+      gd->use_fancy_dots == use_fancy_dots &&
+      gd->use_fancy_rulers == use_fancy_rulers)
+    return true;
+  gd->field_h = field_h;
+  gd->field_w = field_w;
+  gd->scroll_y = scroll_y;
+  gd->scroll_x = scroll_x;
+  gd->draw_h = draw_h;
+  gd->draw_w = draw_w;
+  gd->ruler_spacing_y = ruler_spacing_y;
+  gd->ruler_spacing_x = ruler_spacing_x;
+  gd->use_fancy_dots = use_fancy_dots;
+  gd->use_fancy_rulers = use_fancy_rulers;
+  // Made here instead of at startup because ACS_BULLET isn't known until
+  // curses has been initialized.
+  chtype dot = use_fancy_dots ? ACS_BULLET : '.';
+  if (gd->cell_dot != dot) {
+    for (Usz ig = 0; ig < 256; ++ig) {
+      Glyph g = (Glyph)ig;
+      chtype ch = g == '.' ? dot : (chtype)(U8)g;
+      for (Usz im = 0; im < Cell_marks_count; ++im)
+        gd->cell_chtypes[ig][im] = ch | term_attrs_of_cell(g, (Mark)im);
+    }
+    gd->cell_dot = dot;
+  }
+  Usz rows = draw_h > 0 ? (Usz)draw_h : 0;
+  if (gd->rows_cap < rows) {
+    gd->stale_rows = realloc(gd->stale_rows, rows);
+    gd->overlay_rows = realloc(gd->overlay_rows, rows);
+    gd->rows_cap = rows;
+  }
+  if (rows > 0) {
+    memset(gd->stale_rows, 1, rows);
+    memset(gd->overlay_rows, 0, rows);
+  }
+  gd->is_valid = true;
+  return false;
+}
+
+static void grid_drawn_mark_rows(Grid_drawn *gd, U8 *flags, Isz y, Usz h) {
+  if (y < 0) {
+    if ((Usz)(-y) >= h)
+      return;
+    h -= (Usz)(-y);
+    y = 0;
+  }
+  Usz draw_h = gd->draw_h > 0 ? (Usz)gd->draw_h : 0;
+  if ((Usz)y >= draw_h)
+    return;
+  if (h > draw_h - (Usz)y)
+    h = draw_h - (Usz)y;
+  memset(flags + y, 1, h);
+}
+
+static void grid_drawn_mark_stale(Grid_drawn *gd, Isz y, Usz h) {
+  if (gd->is_valid)
+    grid_drawn_mark_rows(gd, gd->stale_rows, y, h);
+}
+
+// For the next draw with Term_ansi. grid_drawn_begin() has to have been called
+// first.
+static void grid_drawn_mark_overlay(Grid_drawn *gd, Isz y, Usz h) {
+  grid_drawn_mark_rows(gd, gd->overlay_rows, y, h);
+}
+
+// Only writes the cells that differ from what's in drawn, and the rows it has
+// marked as stale. grid_drawn_begin() has to have been called first. If ta
+// isn't null, writes the rows that aren't marked as overlays straight to it.
+staticni void draw_glyphs_grid(WINDOW *win, Term_ansi *ta, Grid_drawn *drawn,
+                               int draw_y, int draw_x, int draw_h, int draw_w,
+                               Glyph const *restrict gbuffer,
                                Mark const *restrict mbuffer, Usz field_h,
                                Usz field_w, Usz offset_y, Usz offset_x,
                                Usz ruler_spacing_y, Usz ruler_spacing_x,
-                               bool use_fancy_dots, bool use_fancy_rulers) {
+                               bool use_fancy_rulers) {
   assert(draw_y >= 0 && draw_x >= 0);
   assert(draw_h >= 0 && draw_w >= 0);
+  assert(drawn->is_valid && drawn->draw_h == draw_h);
   enum { Bufcount = 4096 };
   chtype chbuffer[Bufcount];
   // todo buffer limit
-  if (offset_y >= field_h || offset_x >= field_w)
-    return;
-  if (draw_y >= draw_h || draw_x >= draw_w)
-    return;
-  Usz rows = (Usz)(draw_h - draw_y);
-  if (field_h - offset_y < rows)
-    rows = field_h - offset_y;
-  Usz cols = (Usz)(draw_w - draw_x);
-  if (field_w - offset_x < cols)
-    cols = field_w - offset_x;
-  if (Bufcount < cols)
-    cols = Bufcount;
+  Usz rows = 0, cols = 0;
+  if (offset_y < field_h && offset_x < field_w && draw_y < draw_h &&
+      draw_x < draw_w) {
+    rows = (Usz)(draw_h - draw_y);
+    if (field_h - offset_y < rows)
+      rows = field_h - offset_y;
+    cols = (Usz)(draw_w - draw_x);
+    if (field_w - offset_x < cols)
+      cols = field_w - offset_x;
+    if (Bufcount < cols)
+      cols = Bufcount;
+  }
+  // Stale rows may have had something other than the grid drawn on them,
+  // anywhere across the window, so clear them first. Rows that curses is going
+  // to draw over have to have all of the grid in the window, so they're
+  // treated as stale, too. On the terminal, only the parts of a row that the
+  // grid doesn't cover are cleared, so that no cell is written twice.
+  U8 *stale_rows = drawn->stale_rows;
+  U8 const *overlay_rows = drawn->overlay_rows;
+  for (int y = 0; y < draw_h; ++y) {
+    bool is_direct = ta && !overlay_rows[y];
+    if (ta && !is_direct)
+      stale_rows[y] = 1;
+    if (!stale_rows[y])
+      continue;
+    if (!is_direct) {
+      wmove(win, y, 0);
+      wclrtoeol(win);
+    } else if (y < draw_y || (Usz)(y - draw_y) >= rows || cols == 0) {
+      term_ansi_clear(ta, y, 0, draw_w);
+    } else {
+      int grid_end = draw_x + (int)cols;
+      term_ansi_clear(ta, y, 0, draw_x);
+      term_ansi_clear(ta, y, grid_end, draw_w - grid_end);
+    }
+  }
   if (rows == 0 || cols == 0)
-    return;
+    goto done;
+  // These only change size along with the view, which makes every row stale,
+  // so whatever realloc leaves in them is never compared against.
+  if (drawn->cells_cap < rows * cols) {
+    drawn->gbuffer = realloc(drawn->gbuffer, rows * cols * sizeof(Glyph));
+    drawn->mbuffer = realloc(drawn->mbuffer, rows * cols * sizeof(Mark));
+    drawn->cells_cap = rows * cols;
+  }
   bool use_rulers = ruler_spacing_y != 0 && ruler_spacing_x != 0;
-  chtype bullet = use_fancy_dots ? ACS_BULLET : '.';
   enum { T = 1 << 0, B = 1 << 1, L = 1 << 2, R = 1 << 3 };
   chtype rs[(T | B | L | R) + 1];
   if (use_rulers) {
@@ -591,42 +773,90 @@ staticni void draw_glyphs_grid(WINDOW *win, int draw_y, int draw_x, int draw_h,
       rs[R] = ACS_RTEE;
     }
   }
+  // Column of the first ruler in the visible part of each row.
+  Usz ruler_x0 = 0;
+  if (use_rulers && offset_x % ruler_spacing_x != 0)
+    ruler_x0 = ruler_spacing_x - offset_x % ruler_spacing_x;
   for (Usz iy = 0; iy < rows; ++iy) {
     Usz line_offset = (offset_y + iy) * field_w + offset_x;
     Glyph const *g_row = gbuffer + line_offset;
     Mark const *m_row = mbuffer + line_offset;
+    Glyph *drawn_g_row = drawn->gbuffer + iy * cols;
+    Mark *drawn_m_row = drawn->mbuffer + iy * cols;
+    bool is_stale = stale_rows[(Usz)draw_y + iy];
     bool use_y_ruler = use_rulers && (iy + offset_y) % ruler_spacing_y == 0;
-    for (Usz ix = 0; ix < cols; ++ix) {
-      Glyph g = g_row[ix];
-      Mark m = m_row[ix];
-      chtype ch;
-      if (g == '.') {
-        if (use_y_ruler && (ix + offset_x) % ruler_spacing_x == 0) {
+    Usz ix = 0;
+    for (;;) {
+      // Skip over the cells that are already on screen, 8 at a time while
+      // there are that many left, then find the run of cells after them that
+      // aren't.
+      Usz run_begin, run_end;
+      if (is_stale) {
+        if (ix == cols)
+          break;
+        run_begin = ix;
+        run_end = cols;
+      } else {
+        while (cols - ix >= 8 && memcmp(g_row + ix, drawn_g_row + ix, 8) == 0 &&
+               memcmp(m_row + ix, drawn_m_row + ix, 8) == 0)
+          ix += 8;
+        while (ix < cols && g_row[ix] == drawn_g_row[ix] &&
+               m_row[ix] == drawn_m_row[ix])
+          ++ix;
+        if (ix == cols)
+          break;
+        run_begin = ix;
+        run_end = ix + 1;
+        while (run_end < cols && (g_row[run_end] != drawn_g_row[run_end] ||
+                                  m_row[run_end] != drawn_m_row[run_end]))
+          ++run_end;
+      }
+      Usz run_len = run_end - run_begin;
+      for (Usz i = run_begin; i < run_end; ++i) {
+        Usz m = m_row[i] & (Cell_marks_count - 1);
+        chbuffer[i] = drawn->cell_chtypes[(U8)g_row[i]][m];
+      }
+      if (use_y_ruler) {
+        Usz x = ruler_x0;
+        if (x < run_begin)
+          x += (run_begin - x + ruler_spacing_x - 1) / ruler_spacing_x *
+               ruler_spacing_x;
+        for (; x < run_end; x += ruler_spacing_x) {
+          if (g_row[x] != '.')
+            continue;
           int p = 0; // clang-format off
           if (iy + offset_y     == 0      ) p |= T;
           if (iy + offset_y + 1 == field_h) p |= B;
-          if (ix + offset_x     == 0      ) p |= L;
-          if (ix + offset_x + 1 == field_w) p |= R;
-          ch = rs[p]; // clang-format on
-        } else {
-          ch = bullet;
+          if (x + offset_x      == 0      ) p |= L;
+          if (x + offset_x + 1  == field_w) p |= R;
+          // clang-format on
+          chbuffer[x] = (chbuffer[x] & ~A_CHARTEXT & ~A_ALTCHARSET) | rs[p];
         }
+      }
+      memcpy(drawn_g_row + run_begin, g_row + run_begin, run_len);
+      memcpy(drawn_m_row + run_begin, m_row + run_begin, run_len);
+      int run_y = draw_y + (int)iy, run_x = draw_x + (int)run_begin;
+      if (ta && !overlay_rows[run_y]) {
+        term_ansi_put_chtypes(ta, run_y, run_x, chbuffer + run_begin,
+                              (int)run_len);
       } else {
-        ch = (chtype)g;
+        wmove(win, run_y, run_x);
+        waddchnstr(win, chbuffer + run_begin, (int)run_len);
       }
-      attr_t attrs = term_attrs_of_cell(g, m);
-      chbuffer[ix] = ch | attrs;
+      ix = run_end;
     }
-    wmove(win, draw_y + (int)iy, draw_x);
-    waddchnstr(win, chbuffer, (int)cols);
   }
+done:
+  if (draw_h > 0)
+    memset(stale_rows, 0, (Usz)draw_h);
 }
 
 staticni void draw_glyphs_grid_scrolled(
-    WINDOW *win, int draw_y, int draw_x, int draw_h, int draw_w,
-    Glyph const *restrict gbuffer, Mark const *restrict mbuffer, Usz field_h,
-    Usz field_w, int scroll_y, int scroll_x, Usz ruler_spacing_y,
-    Usz ruler_spacing_x, bool use_fancy_dots, bool use_fancy_rulers) {
+    WINDOW *win, Term_ansi *ta, Grid_drawn *drawn, int draw_y, int draw_x,
+    int draw_h, int draw_w, Glyph const *restrict gbuffer,
+    Mark const *restrict mbuffer, Usz field_h, Usz field_w, int scroll_y,
+    int scroll_x, Usz ruler_spacing_y, Usz ruler_spacing_x,
+    bool use_fancy_rulers) {
   if (scroll_y < 0) {
     draw_y += -scroll_y;
     scroll_y = 0;
@@ -635,10 +865,9 @@ staticni void draw_glyphs_grid_scrolled(
     draw_x += -scroll_x;
     scroll_x = 0;
   }
-  draw_glyphs_grid(win, draw_y, draw_x, draw_h, draw_w, gbuffer, mbuffer,
-                   field_h, field_w, (Usz)scroll_y, (Usz)scroll_x,
-                   ruler_spacing_y, ruler_spacing_x, use_fancy_dots,
-                   use_fancy_rulers);
+  draw_glyphs_grid(win, ta, drawn, draw_y, draw_x, draw_h, draw_w, gbuffer,
+                   mbuffer, field_h, field_w, (Usz)scroll_y, (Usz)scroll_x,
+                   ruler_spacing_y, ruler_spacing_x, use_fancy_rulers);
 }
 
 static void ged_cursor_confine(Ged_cursor *tc, Usz height, Usz width) {
@@ -654,12 +883,12 @@ staticni void draw_oevent_list(WINDOW *win, Oevent_list const *oevent_list) {
   wmove(win, 0, 0);
   int win_h = getmaxy(win);
   wprintw(win, "Count: %d", (int)oevent_list->count);
-  for (Usz i = 0, num_events = oevent_list->count; i < num_events; ++i) {
+  for (Oevent const *ev = oevent_list_begin(oevent_list); ev;
+       ev = oevent_list_next(oevent_list, ev)) {
     int cury = getcury(win);
     if (cury + 1 >= win_h)
       return;
     wmove(win, cury + 1, 0);
-    Oevent const *ev = oevent_list->buffer + i;
     Oevent_types evt = ev->any.oevent_type;
     switch (evt) {
     case Oevent_type_midi_note: {
@@ -691,19 +920,21 @@ staticni void draw_oevent_list(WINDOW *win, Oevent_list const *oevent_list) {
     }
     case Oevent_type_osc_ints: {
       Oevent_osc_ints const *eo = &ev->osc_ints;
+      U8 const *numbers = oevent_osc_ints_numbers(eo);
       wprintw(win, "OSC\t%c\tcount: %d ", eo->glyph, eo->count);
       waddch(win, ACS_VLINE);
       for (Usz j = 0; j < eo->count; ++j) {
-        wprintw(win, " %d", eo->numbers[j]);
+        wprintw(win, " %d", numbers[j]);
       }
       break;
     }
     case Oevent_type_udp_string: {
-      // Oevent_udp_string const *eo = &ev->udp_string;
-      // wprintw(win, "UDP\tcount %d\t", (int)eo->count);
-      // for (Usz j = 0; j < (Usz)eo->count; ++j) {
-      //   waddch(win, (chtype)eo->chars[j]);
-      // }
+      Oevent_udp_string const *eu = &ev->udp_string;
+      char const *chars = oevent_udp_string_chars(eu);
+      wprintw(win, "UDP\tcount %d\t", (int)eu->count);
+      for (Usz j = 0; j < (Usz)eu->count; ++j) {
+        waddch(win, (chtype)(U8)chars[j]);
+      }
       break;
     }
     }
@@ -777,157 +1008,58 @@ staticni bool ged_resize_grid_snap_ruler(Field *field, Mbuf_reusable *mbr,
   return true;
 }
 
-typedef enum {
-  Midi_mode_type_null,
-  Midi_mode_type_osc_bidule,
-#ifdef FEAT_PORTMIDI
-  Midi_mode_type_portmidi,
-#endif
-} Midi_mode_type;
-
+// A copy of the grid, and of the parts of the state that are drawn along with
+// it, made after each step or edit. The UI draws from these instead of from
+// the Ged, so that it doesn't have to hold the Ged lock while drawing.
 typedef struct {
-  Midi_mode_type type;
-} Midi_mode_any;
+  Field field;
+  Mbuf_reusable mbuf_r;
+  Oevent_list oevent_list;
+  Usz tick_num;
+  Usz activity_counter;
+  Usz bpm; // Both of these can be changed by the clock when following MIDI
+  bool is_playing;
+} Ged_frame;
 
+// Three frames: the one being drawn, the one being filled in, and the newest
+// finished one between them. Handing a frame over only swaps indices, so the
+// clock thread never waits for a redraw, and the UI never waits for a copy.
 typedef struct {
-  Midi_mode_type type;
-  char const *path;
-} Midi_mode_osc_bidule;
-
-#ifdef FEAT_PORTMIDI
+  Ged_frame frames[3];
+  pthread_mutex_t mutex;
+  U8 draw_index, write_index, ready_index;
+  bool has_new;
+} Ged_frames;
+
+// The sequencer clock runs on its own thread, so that the timing of steps and
+// of outgoing MIDI and OSC doesn't depend on how long the UI takes to handle
+// input or to redraw the terminal. See ged_clock_thread().
 typedef struct {
-  Midi_mode_type type;
-  PmDeviceID device_id;
-  PortMidiStream *stream;
-} Midi_mode_portmidi;
-// Not sure whether it's OK to call Pm_Terminate() without having a successful
-// call to Pm_Initialize() -- let's just treat it with tweezers.
-static bool portmidi_is_initialized = false;
-#endif
-
-typedef union {
-  Midi_mode_any any;
-  Midi_mode_osc_bidule osc_bidule;
-#ifdef FEAT_PORTMIDI
-  Midi_mode_portmidi portmidi;
-#endif
-} Midi_mode;
-
-void midi_mode_init_null(Midi_mode *mm) { mm->any.type = Midi_mode_type_null; }
-void midi_mode_init_osc_bidule(Midi_mode *mm, char const *path) {
-  mm->osc_bidule.type = Midi_mode_type_osc_bidule;
-  mm->osc_bidule.path = path;
-}
-#ifdef FEAT_PORTMIDI
-enum {
-  Portmidi_artificial_latency = 1,
-};
-struct {
-  U64 clock_base;
-  bool did_init;
-} portmidi_global_data;
-static PmTimestamp portmidi_timestamp_now(void) {
-  if (!portmidi_global_data.did_init) {
-    portmidi_global_data.did_init = true;
-    portmidi_global_data.clock_base = stm_now();
-  }
-  return (PmTimestamp)(stm_ms(stm_since(portmidi_global_data.clock_base)));
-}
-static PmTimestamp portmidi_timeproc(void *time_info) {
-  (void)time_info;
-  return portmidi_timestamp_now();
-}
-static PmError portmidi_init_if_necessary(void) {
-  if (portmidi_is_initialized)
-    return 0;
-  PmError e = Pm_Initialize();
-  if (e)
-    return e;
-  portmidi_is_initialized = true;
-  return 0;
-}
-staticni PmError midi_mode_init_portmidi(Midi_mode *mm, PmDeviceID dev_id) {
-  PmError e = portmidi_init_if_necessary();
-  if (e)
-    goto fail;
-  e = Pm_OpenOutput(&mm->portmidi.stream, dev_id, NULL, 128, portmidi_timeproc,
-                    NULL, Portmidi_artificial_latency);
-  if (e)
-    goto fail;
-  mm->portmidi.type = Midi_mode_type_portmidi;
-  mm->portmidi.device_id = dev_id;
-  return pmNoError;
-fail:
-  midi_mode_init_null(mm);
-  return e;
-}
-// Returns true on success. todo currently output only
-staticni bool portmidi_find_device_id_by_name(char const *name, Usz namelen,
-                                              PmError *out_pmerror,
-                                              PmDeviceID *out_id) {
-  *out_pmerror = portmidi_init_if_necessary();
-  if (*out_pmerror)
-    return false;
-  int num = Pm_CountDevices();
-  for (int i = 0; i < num; ++i) {
-    PmDeviceInfo const *info = Pm_GetDeviceInfo(i);
-    if (!info || !info->output)
-      continue;
-    Usz len = strlen(info->name);
-    if (len != namelen)
-      continue;
-    if (strncmp(name, info->name, namelen) == 0) {
-      *out_id = i;
-      return true;
-    }
-  }
-  return false;
-}
-static bool portmidi_find_name_of_device_id(PmDeviceID id, PmError *out_pmerror,
-                                            oso **out_name) {
-  *out_pmerror = portmidi_init_if_necessary();
-  if (*out_pmerror)
-    return false;
-  int num = Pm_CountDevices();
-  if (id < 0 || id >= num)
-    return false;
-  PmDeviceInfo const *info = Pm_GetDeviceInfo(id);
-  if (!info || !info->output)
-    return false;
-  osoput(out_name, info->name);
-  return true;
-}
-#endif
-staticni void midi_mode_deinit(Midi_mode *mm) {
-  switch (mm->any.type) {
-  case Midi_mode_type_null:
-  case Midi_mode_type_osc_bidule:
-    break;
+  pthread_t thread;
+  // Held around anything that reads or writes the parts of the Ged that the
+  // clock thread uses (see ged_lock()).
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  // Signalled when playback starts, and to quit
+  int wake_fds[2];      // Written to after each step to wake up the UI
+  U32 start_count;      // Incremented each time playback starts
 #ifdef FEAT_PORTMIDI
-  case Midi_mode_type_portmidi:
-    // Because PortMidi seems to work correctly ony more platforms when using
-    // its timing stuff, we are using it. And because we are using it, and
-    // because it may be buffering events for sending 'later', we might have
-    // pending outgoing MIDI events. We'll need to wait until they finish being
-    // before calling Pm_Close, otherwise users could have problems like MIDI
-    // notes being stuck on. This is slow and blocking, but not much we can do
-    // about it right now.
-    //
-    // TODO use nansleep on platforms that support it.
-    for (U64 start = stm_now();
-         stm_ms(stm_since(start)) <= (double)Portmidi_artificial_latency;)
-      sleep(0);
-    Pm_Close(mm->portmidi.stream);
-    break;
+  Midi_clock_in input; // When open, steps follow its beat clock
+  double input_bpm;    // The latest tempo from its pulses, or 0
+  // While following the input, the clock thread waits on this instead of
+  // cond. Written to by the input, and along with signalling cond.
+  int input_wake_fds[2];
 #endif
-  }
-}
+  bool thread_started;
+  bool quit;
+  bool publish_frames; // Off with --no-render, since nothing draws them
+} Ged_clock;
 
 typedef struct {
   Field field;
   Field scratch_field;
   Field clipboard_field;
   Mbuf_reusable mbuf_r;
+  Orca_vm vm;
   Undo_history undo_hist;
   Oevent_list oevent_list;
   Oevent_list scratch_oevent_list;
@@ -937,9 +1069,17 @@ typedef struct {
   Usz ruler_spacing_y, ruler_spacing_x;
   Ged_input_mode input_mode;
   Usz bpm;
-  U64 clock;
+  Ged_clock clock;
+  Ged_frames frames;
+  Grid_drawn grid_drawn;
   double accum_secs;
   double time_to_next_note_off;
+  U64 cc_ramp_time;   // When the MIDI CC ramps were last advanced
+  U64 cc_ramp_period; // Nanoseconds between advancing them. 0: only on steps
+  U64 osc_lookahead;  // Nanoseconds added to OSC bundle time tags
+  bool osc_timetags;  // If false, OSC bundles are tagged 'immediately'
+  bool is_playing;    // Not a bitfield, since the clock thread writes it
+  bool midi_bclock;   // Or reads it
   Oosc_dev *oosc_dev;
   Midi_mode midi_mode;
   Usz activity_counter;
@@ -952,8 +1092,6 @@ typedef struct {
   U8 midi_bclock_sixths;            // 0..5, holds 6th of the quarter note step
   bool needs_remarking : 1;
   bool is_draw_dirty : 1;
-  bool is_playing : 1;
-  bool midi_bclock : 1;
   bool draw_event_list : 1;
   bool is_mouse_down : 1;
   bool is_mouse_dragging : 1;
@@ -965,6 +1103,7 @@ static void ged_init(Ged *a, Usz undo_limit, Usz init_bpm, Usz init_seed) {
   field_init(&a->scratch_field);
   field_init(&a->clipboard_field);
   mbuf_reusable_init(&a->mbuf_r);
+  orca_vm_init(&a->vm);
   undo_history_init(&a->undo_hist, undo_limit);
   oevent_list_init(&a->oevent_list);
   oevent_list_init(&a->scratch_oevent_list);
@@ -974,9 +1113,50 @@ static void ged_init(Ged *a, Usz undo_limit, Usz init_bpm, Usz init_seed) {
   a->ruler_spacing_y = a->ruler_spacing_x = 8;
   a->input_mode = Ged_input_mode_normal;
   a->bpm = init_bpm;
-  a->clock = 0;
+  pthread_mutex_init(&a->clock.lock, NULL);
+  pthread_cond_init(&a->clock.cond, NULL);
+  if (pipe(a->clock.wake_fds) == 0) {
+    fcntl(a->clock.wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(a->clock.wake_fds[1], F_SETFL, O_NONBLOCK);
+  } else {
+    a->clock.wake_fds[0] = a->clock.wake_fds[1] = -1;
+  }
+  a->clock.start_count = 0;
+#ifdef FEAT_PORTMIDI
+  midi_clock_in_init(&a->clock.input);
+  a->clock.input_bpm = 0.0;
+  if (pipe(a->clock.input_wake_fds) == 0) {
+    fcntl(a->clock.input_wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(a->clock.input_wake_fds[1], F_SETFL, O_NONBLOCK);
+  } else {
+    a->clock.input_wake_fds[0] = a->clock.input_wake_fds[1] = -1;
+  }
+#endif
+  a->clock.thread_started = false;
+  a->clock.quit = false;
+  a->clock.publish_frames = true;
+  for (Usz i = 0; i < 3; ++i) {
+    Ged_frame *f = &a->frames.frames[i];
+    field_init(&f->field);
+    mbuf_reusable_init(&f->mbuf_r);
+    oevent_list_init(&f->oevent_list);
+    f->tick_num = 0;
+    f->activity_counter = 0;
+    f->bpm = init_bpm;
+    f->is_playing = false;
+  }
+  pthread_mutex_init(&a->frames.mutex, NULL);
+  a->frames.draw_index = 0;
+  a->frames.write_index = 1;
+  a->frames.ready_index = 2;
+  a->frames.has_new = false;
+  grid_drawn_init(&a->grid_drawn);
   a->accum_secs = 0.0;
   a->time_to_next_note_off = 1.0;
+  a->cc_ramp_time = 0;
+  a->cc_ramp_period = 0;
+  a->osc_lookahead = 0;
+  a->osc_timetags = false;
   a->oosc_dev = NULL;
   midi_mode_init_null(&a->midi_mode);
   a->activity_counter = 0;
@@ -1002,6 +1182,7 @@ static void ged_deinit(Ged *a) {
   field_deinit(&a->scratch_field);
   field_deinit(&a->clipboard_field);
   mbuf_reusable_deinit(&a->mbuf_r);
+  orca_vm_deinit(&a->vm);
   undo_history_deinit(&a->undo_hist);
   oevent_list_deinit(&a->oevent_list);
   oevent_list_deinit(&a->scratch_oevent_list);
@@ -1009,74 +1190,45 @@ static void ged_deinit(Ged *a) {
   if (a->oosc_dev)
     oosc_dev_destroy(a->oosc_dev);
   midi_mode_deinit(&a->midi_mode);
-}
-
-static bool ged_is_draw_dirty(Ged *a) {
-  return a->is_draw_dirty || a->needs_remarking;
-}
-
-staticni void send_midi_3bytes(Oosc_dev *oosc_dev, Midi_mode const *midi_mode,
-                               int status, int byte1, int byte2) {
-  switch (midi_mode->any.type) {
-  case Midi_mode_type_null:
-    break;
-  case Midi_mode_type_osc_bidule: {
-    if (!oosc_dev)
-      break;
-    oosc_send_int32s(oosc_dev, midi_mode->osc_bidule.path,
-                     (int[]){status, byte1, byte2}, 3);
-    break;
-  }
 #ifdef FEAT_PORTMIDI
-  case Midi_mode_type_portmidi: {
-    // timestamp is totally fake, to prevent problems with some MIDI systems
-    // getting angry if there's no timestamping info.
-    //
-    // Eventually, we will want to create real timestamps based on a real orca
-    // clock, instead of ad-hoc at the last moment like this. When we do that,
-    // we'll need to thread the timestamping/timing info through the function
-    // calls, instead of creating it at the last moment here. (This timestamp
-    // is actually 'useless', because it doesn't convey any additional
-    // information. But if we don't provide it, at least to PortMidi, some
-    // people's MIDI setups may malfunction and have terrible timing problems.)
-    PmTimestamp pm_timestamp = portmidi_timestamp_now();
-    PmError pme = Pm_WriteShort(midi_mode->portmidi.stream, pm_timestamp,
-                                Pm_Message(status, byte1, byte2));
-    (void)pme;
-    break;
+  midi_clock_in_deinit(&a->clock.input);
+  if (a->clock.input_wake_fds[0] != -1) {
+    close(a->clock.input_wake_fds[0]);
+    close(a->clock.input_wake_fds[1]);
   }
 #endif
+  pthread_mutex_destroy(&a->clock.lock);
+  pthread_cond_destroy(&a->clock.cond);
+  if (a->clock.wake_fds[0] != -1) {
+    close(a->clock.wake_fds[0]);
+    close(a->clock.wake_fds[1]);
   }
+  for (Usz i = 0; i < 3; ++i) {
+    Ged_frame *f = &a->frames.frames[i];
+    field_deinit(&f->field);
+    mbuf_reusable_deinit(&f->mbuf_r);
+    oevent_list_deinit(&f->oevent_list);
+  }
+  pthread_mutex_destroy(&a->frames.mutex);
+  grid_drawn_deinit(&a->grid_drawn);
 }
 
-static void send_midi_chan_msg(Oosc_dev *oosc_dev, Midi_mode const *midi_mode,
-                               int type /*0..15*/, int chan /*0.. 15*/,
-                               int byte1 /*0..127*/, int byte2 /*0..127*/) {
-  send_midi_3bytes(oosc_dev, midi_mode, type << 4 | chan, byte1, byte2);
-}
-
-static void send_midi_byte(Oosc_dev *oosc_dev, Midi_mode const *midi_mode,
-                           int x) {
-  // PortMidi wants 0 and 0 for the unused bytes. Likewise, Bidule's
-  // MIDI-via-OSC won't accept the message unless there are at least all 3
-  // bytes, with the second 2 set to zero.
-  send_midi_3bytes(oosc_dev, midi_mode, x, 0, 0);
-}
+// The clock thread uses the grid, the marks, the VM, the event lists, the
+// sustained notes, the undo history, the tick number, the tempo, the play
+// state and the MIDI and OSC outputs, so the UI thread has to hold the lock
+// to touch any of those. Everything else in the Ged, like the cursor, the
+// window geometry and the clipboard, is only used by the UI thread, and it
+// can use those freely. The grid's size only changes on the UI thread, too,
+// so it can be read without the lock.
+//
+// The UI holds the lock for as little time as it can, since a step that's
+// due has to wait for it. It doesn't keep it while waiting for input, or
+// while waiting on files or on other programs.
+static void ged_lock(Ged *a) { pthread_mutex_lock(&a->clock.lock); }
+static void ged_unlock(Ged *a) { pthread_mutex_unlock(&a->clock.lock); }
 
-staticni void //
-send_midi_note_offs(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
-                    Susnote const *start, Susnote const *end) {
-  for (; start != end; ++start) {
-#if 0
-    float under = start->remaining;
-    if (under < 0.0) {
-      fprintf(stderr, "cutoff slop: %f\n", under);
-    }
-#endif
-    U16 chan_note = start->chan_note;
-    send_midi_chan_msg(oosc_dev, midi_mode, 0x8, chan_note >> 8,
-                       chan_note & 0xFF, 0);
-  }
+static bool ged_is_draw_dirty(Ged *a) {
+  return a->is_draw_dirty || a->needs_remarking;
 }
 
 static void send_control_message(Oosc_dev *oosc_dev, char const *osc_address) {
@@ -1094,316 +1246,467 @@ static void send_num_message(Oosc_dev *oosc_dev, char const *osc_address,
   oosc_send_int32s(oosc_dev, osc_address, nums, ORCA_ARRAY_COUNTOF(nums));
 }
 
-staticni void apply_time_to_sustained_notes(Oosc_dev *oosc_dev,
-                                            Midi_mode *midi_mode,
-                                            double time_elapsed,
-                                            Susnote_list *susnote_list,
-                                            double *next_note_off_deadline) {
-  Usz start_removed, end_removed;
-  susnote_list_advance_time(susnote_list, time_elapsed, &start_removed,
-                            &end_removed, next_note_off_deadline);
-  if (ORCA_UNLIKELY(start_removed != end_removed)) {
-    Susnote const *restrict susnotes_off = susnote_list->buffer;
-    send_midi_note_offs(oosc_dev, midi_mode, susnotes_off + start_removed,
-                        susnotes_off + end_removed);
-  }
-}
-
 staticni void ged_stop_all_sustained_notes(Ged *a) {
   Susnote_list *sl = &a->susnote_list;
-  send_midi_note_offs(a->oosc_dev, &a->midi_mode, sl->buffer,
-                      sl->buffer + sl->count);
-  susnote_list_clear(sl);
+  Usz removed = susnote_list_remove_all(sl);
+  midi_mode_begin_batch(&a->midi_mode);
+  send_midi_note_offs(a->oosc_dev, &a->midi_mode, sl->removed,
+                      sl->removed + removed);
+  midi_mode_end_batch(&a->midi_mode);
   a->time_to_next_note_off = 1.0;
 }
 
-// The way orca handles MIDI sustains, timing, and overlapping note-ons (plus
-// the 'mono' thing being added) has changed multiple times over time. Now we
-// are in a situation where this function is a complete mess and needs an
-// overhaul. If you see something in the function below and think, "wait, that
-// seems redundant/weird", that's because it is, not because there's a good
-// reason.
-
-staticni void send_output_events(Oosc_dev *oosc_dev, Midi_mode *midi_mode,
-                                 Usz bpm, Susnote_list *susnote_list,
-                                 Oevent const *events, Usz count, Usz tick_num) {
-  enum { Midi_on_capacity = 512 };
-  typedef struct {
-    U8 channel;
-    U8 note_number;
-    U8 velocity;
-  } Midi_note_on;
-  typedef struct {
-    U8 note_number;
-    U8 velocity;
-    U8 duration;
-  } Midi_mono_on;
-  Midi_note_on midi_note_ons[Midi_on_capacity];
-  Midi_mono_on midi_mono_ons[16]; // Keep only a single one per channel
-  Susnote new_susnotes[Midi_on_capacity];
-  Usz midi_note_count = 0;
-  Usz monofied_chans = 0; // bitset of channels with new mono notes
-  double frame_secs = 60.0 / (double)bpm / 4.0;
-
-  for (Usz i = 0; i < count; ++i) {
-    Oevent const *e = events + i;
-    switch ((Oevent_types)e->any.oevent_type) {
-    case Oevent_type_midi_note: {
-      if (midi_note_count == Midi_on_capacity)
-        break;
-      Oevent_midi_note const *em = &e->midi_note;
-      Usz note_number = (Usz)(12u * em->octave + em->note);
-      if (note_number > 127)
-        note_number = 127;
-      Usz channel = em->channel;
-      if (channel > 15)
-        break;
-      if (em->mono) {
-        // 'mono' note-ons are strange. The more typical branch you'd expect to
-        // see, where you can play multiple notes per channel, is below.
-        monofied_chans |= 1u << (channel & 0xFu);
-        midi_mono_ons[channel] = (Midi_mono_on){.note_number = (U8)note_number,
-                                                .velocity = em->velocity,
-                                                .duration = em->duration};
-      } else {
-        midi_note_ons[midi_note_count] =
-            (Midi_note_on){.channel = (U8)channel,
-                           .note_number = (U8)note_number,
-                           .velocity = em->velocity};
-        new_susnotes[midi_note_count] =
-            (Susnote){.remaining = (float)(frame_secs * (double)em->duration),
-                      .chan_note = (U16)((channel << 8u) | note_number)};
-        ++midi_note_count;
-      }
-      break;
-    }
-    case Oevent_type_midi_cc: {
-      Oevent_midi_cc const *ec = &e->midi_cc;
-      // Note that we're not preserving the exact order of MIDI events as
-      // emitted by the orca VM. Notes and CCs that are emitted in the same
-      // step will always have the CCs sent first. Not sure if this is OK or
-      // not. If it's not OK, we can either loop again a second time to always
-      // send CCs after notes, or if that's not also OK, we can make the stack
-      // buffer more complicated and interleave the CCs in it.
-      send_midi_chan_msg(oosc_dev, midi_mode, 0xb, ec->channel, ec->control,
-                         ec->value);
-      break;
-    }
-    case Oevent_type_midi_cc_interpolated: {
-      Oevent_midi_cc_interpolated const *eci = &e->midi_cc_interpolated;
-      // Process the interpolation request to set up state for later processing
-      process_interpolated_midi_cc_event(eci, tick_num);
-      // The interpolation system will generate MIDI CC events during advance_midi_cc_interpolations()
-      break;
-    }
-    case Oevent_type_midi_pb: {
-      Oevent_midi_pb const *ep = &e->midi_pb;
-      // Same caveat regarding ordering with MIDI CC also applies here.
-      send_midi_chan_msg(oosc_dev, midi_mode, 0xe, ep->channel, ep->lsb,
-                         ep->msb);
-      break;
-    }
-    case Oevent_type_osc_ints: {
-      // kinda lame
-      if (!oosc_dev)
-        continue;
-      Oevent_osc_ints const *eo = &e->osc_ints;
-      char path[] = {'/', eo->glyph, '\0'};
-      I32 ints[ORCA_ARRAY_COUNTOF(eo->numbers)];
-      Usz nnum = eo->count;
-      for (Usz inum = 0; inum < nnum; ++inum) {
-        ints[inum] = eo->numbers[inum];
-      }
-      oosc_send_int32s(oosc_dev, path, ints, nnum);
-      break;
-    }
-    case Oevent_type_udp_string: {
-      // if (!oosc_dev)
-      //   continue;
-      // Oevent_udp_string const *eo = &e->udp_string;
-      // oosc_send_datagram(oosc_dev, eo->chars, eo->count);
-      break;
-    }
-    }
-  }
-
-do_note_ons:
-  if (midi_note_count > 0) {
-    Usz start_note_offs, end_note_offs;
-    susnote_list_add_notes(susnote_list, new_susnotes, midi_note_count,
-                           &start_note_offs, &end_note_offs);
-    if (start_note_offs != end_note_offs) {
-      Susnote const *restrict susnotes_off = susnote_list->buffer;
-      send_midi_note_offs(oosc_dev, midi_mode, susnotes_off + start_note_offs,
-                          susnotes_off + end_note_offs);
-    }
-    for (Usz i = 0; i < midi_note_count; ++i) {
-      Midi_note_on mno = midi_note_ons[i];
-      send_midi_chan_msg(oosc_dev, midi_mode, 0x9, mno.channel, mno.note_number,
-                         mno.velocity);
-    }
-  }
-  if (monofied_chans) {
-    // The behavior we end up with is that if regular note-ons are played in
-    // the same frame/step as a mono, the regular note-ons will have the actual
-    // MIDI note on sent, followed immediately by a MIDI note off. I don't know
-    // if this is good or not.
-    Usz start_note_offs, end_note_offs;
-    susnote_list_remove_by_chan_mask(susnote_list, monofied_chans,
-                                     &start_note_offs, &end_note_offs);
-    if (start_note_offs != end_note_offs) {
-      Susnote const *restrict susnotes_off = susnote_list->buffer;
-      send_midi_note_offs(oosc_dev, midi_mode, susnotes_off + start_note_offs,
-                          susnotes_off + end_note_offs);
-    }
-    midi_note_count = 0; // We're going to use this list again. Reset it.
-    for (Usz i = 0; i < 16; i++) { // Add these notes to list of note-ons
-      if (!(monofied_chans & 1u << i))
-        continue;
-      midi_note_ons[midi_note_count] =
-          (Midi_note_on){.channel = (U8)i,
-                         .note_number = midi_mono_ons[i].note_number,
-                         .velocity = midi_mono_ons[i].velocity};
-      new_susnotes[midi_note_count] = (Susnote){
-          .remaining = (float)(frame_secs * (double)midi_mono_ons[i].duration),
-          .chan_note = (U16)((i << 8u) | midi_mono_ons[i].note_number)};
-      midi_note_count++;
-    }
-    monofied_chans = false;
-    goto do_note_ons; // lol super wasteful for doing susnotes again
-  }
-}
-
-staticni void ged_clear_osc_udp(Ged *a) {
-  if (a->oosc_dev) {
-    if (a->midi_mode.any.type == Midi_mode_type_osc_bidule) {
-      ged_stop_all_sustained_notes(a);
-    }
-    oosc_dev_destroy(a->oosc_dev);
-    a->oosc_dev = NULL;
-  }
+// Replaces the OSC output with new_dev, which can be null. Call without the
+// Ged lock held.
+staticni void ged_swap_osc_udp(Ged *a, Oosc_dev *new_dev) {
+  ged_lock(a);
+  Oosc_dev *old_dev = a->oosc_dev;
+  if (old_dev && a->midi_mode.any.type == Midi_mode_type_osc_bidule)
+    ged_stop_all_sustained_notes(a);
+  a->oosc_dev = new_dev;
+  ged_unlock(a);
+  if (old_dev)
+    oosc_dev_destroy(old_dev);
 }
+staticni void ged_clear_osc_udp(Ged *a) { ged_swap_osc_udp(a, NULL); }
 static bool ged_is_using_osc_udp(Ged *a) { return (bool)a->oosc_dev; }
+// Call without the Ged lock held. Looking up the address can take a while, so
+// the lock is only taken after that, to swap in the new output.
 static bool ged_set_osc_udp(Ged *a, char const *dest_addr,
                             char const *dest_port) {
-  ged_clear_osc_udp(a);
+  Oosc_dev *new_dev = NULL;
+  bool ok = true;
   if (dest_port) {
     Oosc_udp_create_error err =
-        oosc_dev_create_udp(&a->oosc_dev, dest_addr, dest_port);
+        oosc_dev_create_udp(&new_dev, dest_addr, dest_port);
     if (err) {
-      return false;
+      new_dev = NULL;
+      ok = false;
     }
   }
-  return true;
+  ged_swap_osc_udp(a, new_dev);
+  return ok;
 }
 
-static ORCA_FORCEINLINE double ms_to_sec(double ms) { return ms / 1000.0; }
-
-static double ged_secs_to_deadline(Ged const *a) {
-  if (!a->is_playing)
-    return 1.0;
-  double secs_span = 60.0 / (double)a->bpm / 4.0;
-  // If MIDI beat clock output is enabled, we need to send an event every 24
-  // parts per quarter note. Since we've already divided quarter notes into 4
-  // for ORCA's timing semantics, divide it by a further 6. This same logic is
-  // mirrored in ged_do_stuff().
-  if (a->midi_bclock)
-    secs_span /= 6.0;
-  double rem = secs_span - (stm_sec(stm_since(a->clock)) + a->accum_secs);
-  double next_note_off = a->time_to_next_note_off;
-  if (next_note_off < rem)
-    rem = next_note_off;
-  if (rem < 0.0)
-    rem = 0.0;
-  return rem;
-}
-
-staticni void clear_and_run_vm(Glyph *restrict gbuf, Mark *restrict mbuf,
-                               Usz height, Usz width, Usz tick_number,
-                               Oevent_list *oevent_list, Usz random_seed) {
+staticni void clear_and_run_vm(Orca_vm *vm, Glyph *restrict gbuf,
+                               Mark *restrict mbuf, Usz height, Usz width,
+                               Usz tick_number, Oevent_list *oevent_list,
+                               Usz random_seed) {
   mbuffer_clear(mbuf, height, width);
   oevent_list_clear(oevent_list);
-  orca_run(gbuf, mbuf, height, width, tick_number, oevent_list, random_seed);
+  orca_vm_run(vm, gbuf, mbuf, height, width, tick_number, oevent_list,
+              random_seed);
+}
+
+//////// Clock thread
+
+// Copies the grid and the state drawn along with it into a frame for the UI to
+// draw. Call with the Ged lock held.
+staticni void ged_publish_frame(Ged *a) {
+  Ged_frames *fs = &a->frames;
+  Ged_frame *f = &fs->frames[fs->write_index];
+  Usz height = a->field.height, width = a->field.width;
+  field_resize_raw_if_necessary(&f->field, height, width);
+  field_copy(&a->field, &f->field);
+  mbuf_reusable_ensure_size(&f->mbuf_r, height, width);
+  memcpy(f->mbuf_r.buffer, a->mbuf_r.buffer, height * width * sizeof(Mark));
+  oevent_list_copy(&a->oevent_list, &f->oevent_list);
+  f->tick_num = a->tick_num;
+  f->activity_counter = a->activity_counter;
+  f->bpm = a->bpm;
+  f->is_playing = a->is_playing;
+  pthread_mutex_lock(&fs->mutex);
+  U8 ready = fs->ready_index;
+  fs->ready_index = fs->write_index;
+  fs->write_index = ready;
+  fs->has_new = true;
+  pthread_mutex_unlock(&fs->mutex);
 }
 
-staticni void ged_do_stuff(Ged *a) {
-  if (!a->is_playing)
+// Returns the newest published frame. Only the UI thread calls this, and the
+// frame stays valid until its next call. Sets *out_is_new if the frame
+// wasn't returned by the previous call.
+static Ged_frame const *ged_take_frame(Ged *a, bool *out_is_new) {
+  Ged_frames *fs = &a->frames;
+  pthread_mutex_lock(&fs->mutex);
+  bool is_new = fs->has_new;
+  if (is_new) {
+    U8 ready = fs->ready_index;
+    fs->ready_index = fs->draw_index;
+    fs->draw_index = ready;
+    fs->has_new = false;
+  }
+  pthread_mutex_unlock(&fs->mutex);
+  *out_is_new = is_new;
+  return &fs->frames[fs->draw_index];
+}
+
+// Moves the MIDI CC ramps along to time (from midi_clock_now_ns()) and sends
+// the values that changed. Call with the Ged lock held.
+staticni void ged_advance_cc_ramps(Ged *a, U64 time) {
+  double secs =
+      time > a->cc_ramp_time ? (double)(time - a->cc_ramp_time) / 1e9 : 0.0;
+  a->cc_ramp_time = time;
+  if (!has_midi_cc_interpolations(&a->vm))
     return;
-  double secs_span = 60.0 / (double)a->bpm / 4.0;
-  if (a->midi_bclock) // see also ged_secs_to_deadline()
-    secs_span /= 6.0;
-  Oosc_dev *oosc_dev = a->oosc_dev;
-  Midi_mode *midi_mode = &a->midi_mode;
-  bool crossed_deadline = false;
-#if TIME_DEBUG
-  Usz spins = 0;
-  U64 spin_start = stm_now();
-  (void)spin_start;
-#endif
-  for (;;) {
-    U64 now = stm_now();
-    U64 diff = stm_diff(now, a->clock);
-    double sdiff = stm_sec(diff) + a->accum_secs;
-    if (sdiff >= secs_span) {
-      a->clock = now;
-      a->accum_secs = sdiff - secs_span;
-#if TIME_DEBUG
-      if (a->accum_secs > 0.000001) {
-        fprintf(stderr, "late: %.2f u-secs\n", a->accum_secs * 1000 * 1000);
-        if (a->accum_secs > 0.00005) {
-          fprintf(stderr, "guilty timeout: %d\n", spin_track_timeout);
-        }
-      }
-#endif
-      crossed_deadline = true;
-      break;
-    }
-    if (secs_span - sdiff > ms_to_sec(0.1))
-      break;
-#if TIME_DEBUG
-    ++spins;
-#endif
+  advance_midi_cc_interpolations(&a->vm, secs, &a->scratch_oevent_list);
+  if (a->scratch_oevent_list.count > 0) {
+    send_output_events(a->oosc_dev, &a->midi_mode, a->bpm, &a->susnote_list,
+                       &a->vm, &a->scratch_oevent_list);
+    oevent_list_clear(&a->scratch_oevent_list);
   }
-#if TIME_DEBUG
-  if (spins > 0) {
-    fprintf(stderr, "%d spins in %f us with timeout %d\n", (int)spins,
-            stm_us(stm_since(spin_start)), spin_track_timeout);
+}
+
+// Sends the OSC bundle for a step that was due at step_time. Anything sent
+// from outside of the clock, like the note-offs when stopping, goes out
+// immediately and on its own.
+static void ged_clock_step_done(Ged *a, U64 step_time) {
+  if (a->oosc_dev) {
+    U64 timetag = Oosc_timetag_immediately;
+    if (a->osc_timetags)
+      timetag = oosc_timetag_from_monotonic_ns(step_time + a->osc_lookahead);
+    oosc_flush_bundle(a->oosc_dev, timetag);
   }
-#endif
-  if (!crossed_deadline)
-    return;
-  if (a->midi_bclock) {
-    send_midi_byte(oosc_dev, midi_mode, 0xF8); // MIDI beat clock
+  midi_mode_set_send_time(&a->midi_mode, 0);
+}
+
+// Runs one step of the clock. If is_pulse is set, the step is one of the 24
+// MIDI beat clock pulses per quarter note, so there are 6 of them per VM tick,
+// and it's sent out as one when MIDI beat clock output is enabled. tick_secs
+// is the length of a whole VM tick. step_time is when the step was due, from
+// midi_clock_now_ns(). Returns true if the VM was run. Call with the Ged lock
+// held.
+staticni bool ged_clock_step(Ged *a, bool is_pulse, double tick_secs,
+                             U64 step_time) {
+  Oosc_dev *oosc_dev = a->oosc_dev;
+  Midi_mode *midi_mode = &a->midi_mode;
+  // Everything sent over OSC for this step goes out as one bundle.
+  if (oosc_dev)
+    oosc_begin_bundle(oosc_dev);
+  midi_mode_set_send_time(midi_mode, step_time);
+  ged_advance_cc_ramps(a, step_time);
+  if (is_pulse) {
+    if (a->midi_bclock)
+      send_midi_byte(oosc_dev, midi_mode, 0xF8); // MIDI beat clock
     Usz sixths = a->midi_bclock_sixths;
     a->midi_bclock_sixths = (U8)((sixths + 1) % 6);
-    if (sixths != 0)
-      return;
+    if (sixths != 0) {
+      ged_clock_step_done(a, step_time);
+      return false;
+    }
   }
-  apply_time_to_sustained_notes(oosc_dev, midi_mode, secs_span,
+  apply_time_to_sustained_notes(oosc_dev, midi_mode, tick_secs,
                                 &a->susnote_list, &a->time_to_next_note_off);
-  
-  // Process MIDI CC interpolations and generate intermediate CC events
-  advance_midi_cc_interpolations(secs_span, &a->scratch_oevent_list);
-  
-  // Send any generated interpolated CC events
-  if (a->scratch_oevent_list.count > 0) {
-    send_output_events(oosc_dev, midi_mode, a->bpm, &a->susnote_list,
-                       a->scratch_oevent_list.buffer, a->scratch_oevent_list.count, a->tick_num);
-    oevent_list_clear(&a->scratch_oevent_list); // Clear for next use
-  }
-  
-  clear_and_run_vm(a->field.buffer, a->mbuf_r.buffer, a->field.height,
+
+  clear_and_run_vm(&a->vm, a->field.buffer, a->mbuf_r.buffer, a->field.height,
                    a->field.width, a->tick_num, &a->oevent_list,
                    a->random_seed);
   ++a->tick_num;
-  a->needs_remarking = true;
-  a->is_draw_dirty = true;
 
   Usz count = a->oevent_list.count;
   if (count > 0) {
-    send_output_events(oosc_dev, midi_mode, a->bpm, &a->susnote_list,
-                       a->oevent_list.buffer, count, a->tick_num);
+    send_output_events(oosc_dev, midi_mode, a->bpm, &a->susnote_list, &a->vm,
+                       &a->oevent_list);
     a->activity_counter += count;
+    // Ramps with an interpolation rate of 0 jump straight to their value, so
+    // send those now instead of on the next advance.
+    ged_advance_cc_ramps(a, step_time);
+  }
+  ged_clock_step_done(a, step_time);
+  return true;
+}
+
+static void clock_sleep_until_ns(U64 deadline) {
+#if defined(TIMER_ABSTIME) && !defined(__APPLE__)
+  struct timespec ts;
+  ts.tv_sec = (time_t)(deadline / UINT64_C(1000000000));
+  ts.tv_nsec = (long)(deadline % UINT64_C(1000000000));
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+#else
+  // No clock_nanosleep() on macOS. A relative sleep is late by however long
+  // it takes to get from here to the syscall, which is fine.
+  U64 now = midi_clock_now_ns();
+  if (now >= deadline)
+    return;
+  U64 rem = deadline - now;
+  struct timespec ts;
+  ts.tv_sec = (time_t)(rem / UINT64_C(1000000000));
+  ts.tv_nsec = (long)(rem % UINT64_C(1000000000));
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+  }
+#endif
+}
+
+// The longest the clock thread sleeps before looking at the tempo and the
+// play state again, so that changes to them take effect promptly.
+#define CLOCK_MAX_SLEEP_NS UINT64_C(20000000)
+
+static void ged_clock_wake_ui(Ged_clock *c) {
+  if (c->wake_fds[1] == -1)
+    return;
+  char b = 0;
+  ssize_t res = write(c->wake_fds[1], &b, 1);
+  (void)res; // If the pipe is full, the UI is already going to wake up.
+}
+
+// Wakes up the clock thread to look at the play state again, whether it's
+// following the clock input or not. Call with the Ged lock held.
+static void ged_clock_signal(Ged_clock *c) {
+  pthread_cond_signal(&c->cond);
+#ifdef FEAT_PORTMIDI
+  if (c->input_wake_fds[1] == -1)
+    return;
+  char b = 0;
+  ssize_t res = write(c->input_wake_fds[1], &b, 1);
+  (void)res; // If the pipe is full, the clock thread is already going to wake.
+#endif
+}
+
+// Between steps, moves the MIDI CC ramps along if it's time to. Call with the
+// Ged lock held. Returns the time it next needs to be called, or 0 if it's
+// only going to be needed after the next step.
+static U64 ged_clock_tend_cc_ramps(Ged *a, U64 now) {
+  if (!a->cc_ramp_period || !has_midi_cc_interpolations(&a->vm))
+    return 0;
+  U64 next_cc = a->cc_ramp_time + a->cc_ramp_period;
+  if (now < next_cc)
+    return next_cc;
+  if (a->oosc_dev)
+    oosc_begin_bundle(a->oosc_dev);
+  midi_mode_set_send_time(&a->midi_mode, now);
+  ged_advance_cc_ramps(a, now);
+  ged_clock_step_done(a, now);
+  return now + a->cc_ramp_period;
+}
+
+// After a step, or anything else from the clock thread that changes what's
+// drawn, hands the UI a new frame and wakes it up to draw it.
+static void ged_clock_publish(Ged *a) {
+  if (!a->clock.publish_frames)
+    return;
+  ged_publish_frame(a);
+  ged_clock_wake_ui(&a->clock);
+}
+
+#ifdef FEAT_PORTMIDI
+// Start and Continue from the clock input. Start also rewinds to tick 0.
+staticni void ged_clock_follow_start(Ged *a, bool rewind) {
+  if (!a->is_playing) {
+    undo_history_push(&a->undo_hist, &a->field, a->tick_num);
+    a->is_playing = true;
+    // Ramps don't move while stopped.
+    a->cc_ramp_time = midi_clock_now_ns();
+    send_control_message(a->oosc_dev, "/orca/started");
+  }
+  if (rewind)
+    a->tick_num = 0;
+  a->midi_bclock_sixths = 0;
+  if (a->midi_bclock)
+    send_midi_byte(a->oosc_dev, &a->midi_mode, rewind ? 0xFA : 0xFB);
+}
+
+// Stop from the clock input.
+staticni void ged_clock_follow_stop(Ged *a) {
+  if (a->is_playing) {
+    ged_stop_all_sustained_notes(a);
+    a->is_playing = false;
+    send_control_message(a->oosc_dev, "/orca/stopped");
+  }
+  if (a->midi_bclock)
+    send_midi_byte(a->oosc_dev, &a->midi_mode, 0xFC);
+}
+
+// Steps along with the beat clock from the clock input, instead of timing the
+// steps itself: each pulse is a clock step, and Start, Continue, Stop and Song
+// Position Pointer control playback and set the tick number. The tempo is
+// taken from the input, too. Handles whatever the input's reading thread has
+// passed along since the last call, then waits for it to pass along more, or
+// for the next MIDI CC ramp update. The Ged lock is only released while
+// waiting.
+staticni void ged_clock_follow_input(Ged *a) {
+  Ged_clock *c = &a->clock;
+  int wake_fd = c->input_wake_fds[0];
+  if (wake_fd != -1) {
+    // Emptied before reading the events, so that any pushed after this leave
+    // something in it to wake up to.
+    char buff[64];
+    while (read(wake_fd, buff, sizeof buff) > 0) {
+    }
+  }
+  Midi_clock_event events[64];
+  Usz count = midi_clock_in_read(&c->input, events, ORCA_ARRAY_COUNTOF(events));
+  bool changed = false;
+  for (Usz i = 0; i < count; ++i) {
+    Midi_clock_event const *ev = &events[i];
+    switch (ev->type) {
+    case Midi_clock_event_pulse:
+      if (ev->bpm >= 1.0) {
+        c->input_bpm = ev->bpm;
+        if ((Usz)(ev->bpm + 0.5) != a->bpm) {
+          a->bpm = (Usz)(ev->bpm + 0.5);
+          send_num_message(a->oosc_dev, "/orca/bpm", (I32)a->bpm);
+          changed = true;
+        }
+      }
+      if (a->is_playing) {
+        double bpm = c->input_bpm >= 1.0 ? c->input_bpm : (double)a->bpm;
+        changed |= ged_clock_step(a, true, 60.0 / bpm / 4.0,
+                                  ev->time + MIDI_CLOCK_IN_DELAY_NS);
+      }
+      break;
+    case Midi_clock_event_start:
+    case Midi_clock_event_continue:
+      ged_clock_follow_start(a, ev->type == Midi_clock_event_start);
+      changed = true;
+      break;
+    case Midi_clock_event_stop:
+      ged_clock_follow_stop(a);
+      changed = true;
+      break;
+    case Midi_clock_event_song_position:
+      a->tick_num = ev->song_position;
+      a->midi_bclock_sixths = 0;
+      changed = true;
+      break;
+    }
+  }
+  if (changed)
+    ged_clock_publish(a);
+  int timeout_ms = -1;
+  if (a->is_playing) {
+    U64 now = midi_clock_now_ns();
+    U64 next_cc = ged_clock_tend_cc_ramps(a, now);
+    // Rounded up, so that it doesn't wake up just before it's time.
+    if (next_cc > now)
+      timeout_ms = (int)((next_cc - now + 999999) / UINT64_C(1000000));
+  }
+  // Without the pipe, fall back to looking for events as often as the input
+  // is read.
+  if (wake_fd == -1 && timeout_ms == -1)
+    timeout_ms = (int)(MIDI_CLOCK_IN_POLL_NS / UINT64_C(1000000));
+  struct pollfd pfd;
+  pfd.fd = wake_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  pthread_mutex_unlock(&c->lock);
+  poll(&pfd, 1, timeout_ms);
+  pthread_mutex_lock(&c->lock);
+}
+#endif
+
+// Sleeps until the absolute time of the next step, so that time spent running
+// the VM and sending events doesn't add up into drift. The Ged lock is only
+// released while sleeping.
+static void *ged_clock_thread(void *arg) {
+  Ged *a = arg;
+  Ged_clock *c = &a->clock;
+  U64 last_step = 0;
+  U32 start_count = 0;
+  bool was_playing = false;
+  pthread_mutex_lock(&c->lock);
+  while (!c->quit) {
+#ifdef FEAT_PORTMIDI
+    if (c->input.stream) {
+      ged_clock_follow_input(a);
+      was_playing = false;
+      continue;
+    }
+#endif
+    if (!a->is_playing) {
+      was_playing = false;
+      pthread_cond_wait(&c->cond, &c->lock);
+      continue;
+    }
+    double tick_secs = 60.0 / (double)a->bpm / 4.0;
+    double secs_span = tick_secs;
+    // If MIDI beat clock output is enabled, we need to send an event every 24
+    // parts per quarter note. Since we've already divided quarter notes into
+    // 4 for ORCA's timing semantics, divide it by a further 6. This same logic
+    // is mirrored in ged_clock_step().
+    if (a->midi_bclock)
+      secs_span /= 6.0;
+    U64 span_ns = (U64)(secs_span * 1e9);
+    U64 now = midi_clock_now_ns();
+    if (!was_playing || start_count != c->start_count) {
+      // ged_set_playing() sets accum_secs to how much of the first step
+      // should count as having already passed.
+      U64 accum_ns = (U64)(a->accum_secs * 1e9);
+      last_step = now > accum_ns ? now - accum_ns : 0;
+      start_count = c->start_count;
+      was_playing = true;
+      // Ramps don't move while stopped.
+      a->cc_ramp_time = now;
+    }
+    U64 deadline = last_step + span_ns;
+    if (now < deadline) {
+      U64 wake = deadline - now > CLOCK_MAX_SLEEP_NS ? now + CLOCK_MAX_SLEEP_NS
+                                                     : deadline;
+      // Between steps, wake up to move the MIDI CC ramps along.
+      U64 next_cc = ged_clock_tend_cc_ramps(a, now);
+      if (next_cc && next_cc < wake)
+        wake = next_cc;
+      pthread_mutex_unlock(&c->lock);
+      clock_sleep_until_ns(wake);
+      pthread_mutex_lock(&c->lock);
+      continue;
+    }
+    // If we fell more than a whole step behind (the machine was suspended, or
+    // we were stopped in a debugger), start over from now instead of trying
+    // to catch up with a burst of steps.
+    last_step = now - deadline > span_ns ? now : deadline;
+    if (ged_clock_step(a, a->midi_bclock, tick_secs, last_step))
+      ged_clock_publish(a);
+  }
+  pthread_mutex_unlock(&c->lock);
+  return NULL;
+}
+
+// Starts the clock thread. If use_realtime is set, also asks for SCHED_FIFO
+// scheduling for it, and returns the error number if that fails.
+staticni int ged_clock_start(Ged *a, bool use_realtime) {
+  Ged_clock *c = &a->clock;
+  int err = pthread_create(&c->thread, NULL, ged_clock_thread, a);
+  if (err)
+    return err;
+  c->thread_started = true;
+  if (!use_realtime)
+    return 0;
+  int min_prio = sched_get_priority_min(SCHED_FIFO);
+  int max_prio = sched_get_priority_max(SCHED_FIFO);
+  struct sched_param param = {0};
+  param.sched_priority = min_prio + (max_prio - min_prio) / 2;
+  return pthread_setschedparam(c->thread, SCHED_FIFO, &param);
+}
+
+// Call without the Ged lock held.
+staticni void ged_clock_stop(Ged *a) {
+  Ged_clock *c = &a->clock;
+  if (!c->thread_started)
+    return;
+  pthread_mutex_lock(&c->lock);
+  c->quit = true;
+  ged_clock_signal(c);
+  pthread_mutex_unlock(&c->lock);
+  pthread_join(c->thread, NULL);
+  c->thread_started = false;
+}
+
+// Waits until there's terminal input, the clock thread has finished a step,
+// or timeout_ms passes. Call without the Ged lock held.
+static void ged_clock_wait(Ged *a, int timeout_ms) {
+  int wake_fd = a->clock.wake_fds[0];
+  struct pollfd fds[2];
+  fds[0].fd = STDIN_FILENO;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = wake_fd;
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+  if (poll(fds, 2, timeout_ms) > 0 && (fds[1].revents & POLLIN)) {
+    char buf[64];
+    while (read(wake_fd, buf, sizeof buf) > 0) {
+    }
   }
 }
 
@@ -1478,51 +1781,95 @@ staticni void ged_set_window_size(Ged *a, int win_h, int win_w,
   ged_make_cursor_visible(a);
 }
 
-staticni void ged_draw(Ged *a, WINDOW *win, char const *filename,
-                       bool use_fancy_dots, bool use_fancy_rulers) {
-  // We can predictavely step the next simulation tick and then use the
-  // resulting mark buffer for better UI visualization. If we don't do this,
-  // after loading a fresh file or after the user performs some edit (or even
-  // after a regular simulation step), the new glyph buffer won't have had
-  // phase 0 of the simulation run, which means the ports and other flags won't
-  // be set on the mark buffer, so the colors for disabled cells, ports, etc.
-  // won't be set.
-  //
-  // We can just perform a simulation step using the current state, keep the
-  // mark buffer that it produces, then roll back the glyph buffer to where it
-  // was before. This should produce results similar to having specialized UI
-  // code that looks at each glyph and figures out the ports, etc.
-  if (a->needs_remarking && !a->is_playing) {
-    field_resize_raw_if_necessary(&a->scratch_field, a->field.height,
-                                  a->field.width);
-    field_copy(&a->field, &a->scratch_field);
+// Brings the marks up to date if needed and publishes the grid as a frame for
+// ged_draw(). Call with the Ged lock held.
+staticni void ged_prepare_draw(Ged *a) {
+  // After loading a fresh file or after the user performs some edit, the
+  // mark buffer is out of date, so the colors for ports, locked cells, etc.
+  // would be wrong. orca_mark() works them out from the grid as it is,
+  // without running a step, so it doesn't change what plays next. This is
+  // done while playing too: at a slow tempo, waiting for the next step would
+  // leave an edit drawn with the wrong colors for a noticeable moment.
+  if (a->needs_remarking) {
     mbuf_reusable_ensure_size(&a->mbuf_r, a->field.height, a->field.width);
-    clear_and_run_vm(a->scratch_field.buffer, a->mbuf_r.buffer, a->field.height,
-                     a->field.width, a->tick_num, &a->scratch_oevent_list,
-                     a->random_seed);
-    a->needs_remarking = false;
+    orca_mark(&a->vm, a->field.buffer, a->mbuf_r.buffer, a->field.height,
+              a->field.width);
   }
+  ged_publish_frame(a);
+  a->needs_remarking = false;
+  a->is_draw_dirty = false;
+}
+
+// Draws from a published frame instead of from the live grid, so that it can
+// be called while the clock thread is running the VM. Everything else it
+// reads from the Ged is only written by the UI thread.
+//
+// The window is left as it was between calls: only the grid cells that changed
+// are written again, and the rest of the window is drawn over from scratch.
+//
+// If ta isn't null, the frame is drawn with it instead of being left in the
+// window for curses: the grid is written to it directly, and only the cursor,
+// the HUD and whatever else is drawn with curses is copied out of the window.
+staticni void ged_draw(Ged *a, Ged_frame const *f, WINDOW *win, Term_ansi *ta,
+                       char const *filename, bool use_fancy_dots,
+                       bool use_fancy_rulers) {
+  Usz field_h = f->field.height, field_w = f->field.width;
   int win_w = a->win_w;
-  draw_glyphs_grid_scrolled(
-      win, 0, 0, a->grid_h, win_w, a->field.buffer, a->mbuf_r.buffer,
-      a->field.height, a->field.width, a->grid_scroll_y, a->grid_scroll_x,
-      a->ruler_spacing_y, a->ruler_spacing_x, use_fancy_dots, use_fancy_rulers);
-  draw_grid_cursor(win, 0, 0, a->grid_h, win_w, a->field.buffer,
-                   a->field.height, a->field.width, a->grid_scroll_y,
-                   a->grid_scroll_x, a->ged_cursor.y, a->ged_cursor.x,
-                   a->ged_cursor.h, a->ged_cursor.w, a->input_mode,
-                   a->is_playing);
+  Grid_drawn *drawn = &a->grid_drawn;
+  // If the terminal was cleared, so was the grid on it.
+  if (ta && !term_ansi_begin(ta, win))
+    drawn->is_valid = false;
+  if (grid_drawn_begin(drawn, field_h, field_w, a->grid_scroll_y,
+                       a->grid_scroll_x, a->grid_h, win_w, a->ruler_spacing_y,
+                       a->ruler_spacing_x, use_fancy_dots, use_fancy_rulers)) {
+    wmove(win, a->grid_h, 0);
+    wclrtobot(win);
+  } else {
+    werase(win);
+  }
+  if (ta) {
+    // Everything below that's drawn over the grid with curses.
+    memset(drawn->overlay_rows, 0, (Usz)a->grid_h);
+    if (a->draw_event_list)
+      grid_drawn_mark_overlay(drawn, 0, (Usz)a->grid_h);
+    grid_drawn_mark_overlay(drawn, (Isz)a->ged_cursor.y - a->grid_scroll_y,
+                            a->ged_cursor.h);
+    if (a->is_hud_visible)
+      grid_drawn_mark_overlay(drawn, a->win_h - 3, 2);
+  }
+  draw_glyphs_grid_scrolled(win, ta, drawn, 0, 0, a->grid_h, win_w,
+                            f->field.buffer, f->mbuf_r.buffer, field_h,
+                            field_w, a->grid_scroll_y, a->grid_scroll_x,
+                            a->ruler_spacing_y, a->ruler_spacing_x,
+                            use_fancy_rulers);
+  draw_grid_cursor(win, 0, 0, a->grid_h, win_w, f->field.buffer, field_h,
+                   field_w, a->grid_scroll_y, a->grid_scroll_x,
+                   a->ged_cursor.y, a->ged_cursor.x, a->ged_cursor.h,
+                   a->ged_cursor.w, a->input_mode, f->is_playing);
+  grid_drawn_mark_stale(drawn, (Isz)a->ged_cursor.y - a->grid_scroll_y,
+                        a->ged_cursor.h);
+  // The HUD's tooltips go on the third row from the bottom, which can be the
+  // last row of the grid.
+  grid_drawn_mark_stale(drawn, a->win_h - 3, 1);
   if (a->is_hud_visible) {
     filename = filename ? filename : "unnamed";
     int hud_x = win_w > 50 + a->softmargin_x * 2 ? a->softmargin_x : 0;
-    draw_hud(win, a->grid_h, hud_x, Hud_height, win_w, filename,
-             a->field.height, a->field.width, a->ruler_spacing_y,
-             a->ruler_spacing_x, a->tick_num, a->bpm, &a->ged_cursor,
-             a->input_mode, a->activity_counter, a->field.buffer, a->mbuf_r.buffer);
+    draw_hud(win, a->grid_h, hud_x, Hud_height, win_w, filename, field_h,
+             field_w, a->ruler_spacing_y, a->ruler_spacing_x, f->tick_num,
+             f->bpm, &a->ged_cursor, a->input_mode, f->activity_counter,
+             f->field.buffer, f->mbuf_r.buffer);
+  }
+  if (a->draw_event_list) {
+    draw_oevent_list(win, &f->oevent_list);
+    drawn->is_valid = false;
+  }
+  if (ta) {
+    for (int y = 0; y < a->grid_h; ++y) {
+      if (drawn->overlay_rows[y])
+        term_ansi_copy_lines(ta, win, y, 1);
+    }
+    term_ansi_copy_lines(ta, win, a->grid_h, a->win_h - a->grid_h);
   }
-  if (a->draw_event_list)
-    draw_oevent_list(win, &a->oevent_list);
-  a->is_draw_dirty = false;
 }
 
 staticni void ged_send_osc_bpm(Ged *a, I32 bpm) {
@@ -1637,6 +1984,9 @@ staticni bool ged_slide_selection(Ged *a, int delta_y, int delta_x) {
                        curs_w_0, '.');
   gbuffer_fill_subrect(a->field.buffer, field_h, field_w, curs_y_0, ex,
                        curs_h_0, ew, '.');
+  // The source and destination rects overlap and together cover everything
+  // that changed, so just invalidate.
+  oper_index_invalidate(&a->vm.oper_index);
   a->needs_remarking = true;
   return true;
 }
@@ -1749,6 +2099,7 @@ ORCA_OK_IF_UNUSED staticni void ged_mouse_event(Ged *a, Usz vis_y, Usz vis_x,
       // own.
       fflush(stdout);
       wclear(stdscr);
+      a->grid_drawn.is_valid = false;
       a->is_mouse_down = true;
       a->ged_cursor.y = y;
       a->ged_cursor.x = x;
@@ -1812,6 +2163,7 @@ staticni void ged_resize_grid_relative(Ged *a, Isz delta_y, Isz delta_x) {
   ged_resize_grid_snap_ruler(&a->field, &a->mbuf_r, a->ruler_spacing_y,
                              a->ruler_spacing_x, delta_y, delta_x, a->tick_num,
                              &a->scratch_field, &a->undo_hist, &a->ged_cursor);
+  oper_index_invalidate(&a->vm.oper_index);
   a->needs_remarking = true; // could check if we actually resized
   a->is_draw_dirty = true;
   ged_update_internal_geometry(a);
@@ -1822,6 +2174,8 @@ staticni void ged_write_character(Ged *a, char c) {
   undo_history_push(&a->undo_hist, &a->field, a->tick_num);
   gbuffer_poke(a->field.buffer, a->field.height, a->field.width,
                a->ged_cursor.y, a->ged_cursor.x, c);
+  oper_index_update_cell(&a->vm.oper_index, a->ged_cursor.y, a->ged_cursor.x,
+                         (Glyph)c);
   // Indicate we want the next simulation step to be run predictavely,
   // so that we can use the reulsting mark buffer for UI visualization.
   // This is "expensive", so it could be skipped for non-interactive
@@ -1841,6 +2195,8 @@ staticni bool ged_fill_selection_with_char(Ged *a, Glyph c) {
     return false;
   gbuffer_fill_subrect(a->field.buffer, a->field.height, a->field.width, curs_y,
                        curs_x, curs_h, curs_w, c);
+  oper_index_update_rect(&a->vm.oper_index, a->field.buffer, a->field.height,
+                         a->field.width, curs_y, curs_x, curs_h, curs_w);
   return true;
 }
 
@@ -1898,7 +2254,6 @@ staticni void ged_set_playing(Ged *a, bool playing) {
   if (playing) {
     undo_history_push(&a->undo_hist, &a->field, a->tick_num);
     a->is_playing = true;
-    a->clock = stm_now();
     a->midi_bclock_sixths = 0;
     // dumb'n'dirty, get us close to the next step time, but not quite
     a->accum_secs = 60.0 / (double)a->bpm / 4.0;
@@ -1907,6 +2262,8 @@ staticni void ged_set_playing(Ged *a, bool playing) {
       a->accum_secs /= 6.0;
     }
     a->accum_secs -= 0.0001;
+    ++a->clock.start_count;
+    ged_clock_signal(&a->clock);
     send_control_message(a->oosc_dev, "/orca/started");
   } else {
     ged_stop_all_sustained_notes(a);
@@ -1927,6 +2284,7 @@ staticni void ged_input_cmd(Ged *a, Ged_input_cmd ev) {
       undo_history_apply(&a->undo_hist, &a->field, &a->tick_num);
     else
       undo_history_pop(&a->undo_hist, &a->field, &a->tick_num);
+    oper_index_invalidate(&a->vm.oper_index);
     ged_cursor_confine(&a->ged_cursor, a->field.height, a->field.width);
     ged_update_internal_geometry(a);
     ged_make_cursor_visible(a);
@@ -1953,9 +2311,9 @@ staticni void ged_input_cmd(Ged *a, Ged_input_cmd ev) {
     break;
   case Ged_input_cmd_step_forward:
     undo_history_push(&a->undo_hist, &a->field, a->tick_num);
-    clear_and_run_vm(a->field.buffer, a->mbuf_r.buffer, a->field.height,
-                     a->field.width, a->tick_num, &a->oevent_list,
-                     a->random_seed);
+    clear_and_run_vm(&a->vm, a->field.buffer, a->mbuf_r.buffer,
+                     a->field.height, a->field.width, a->tick_num,
+                     &a->oevent_list, a->random_seed);
     ++a->tick_num;
     a->activity_counter += a->oevent_list.count;
     a->needs_remarking = true;
@@ -2001,6 +2359,8 @@ staticni void ged_input_cmd(Ged *a, Ged_input_cmd ev) {
     gbuffer_copy_subrect(cb_field->buffer, a->field.buffer, cbfield_h,
                          cbfield_w, field_h, field_w, 0, 0, curs_y, curs_x,
                          cpy_h, cpy_w);
+    oper_index_update_rect(&a->vm.oper_index, a->field.buffer, field_h, field_w,
+                           curs_y, curs_x, cpy_h, cpy_w);
     a->ged_cursor.h = cpy_h;
     a->ged_cursor.w = cpy_w;
     a->needs_remarking = true;
@@ -2055,6 +2415,7 @@ enum {
   Set_fancy_grid_rulers_menu_id,
 #ifdef FEAT_PORTMIDI
   Portmidi_output_device_menu_id,
+  Portmidi_clock_input_menu_id,
 #endif
 };
 enum {
@@ -2189,12 +2550,18 @@ static void push_osc_output_port_form(char const *initial) {
 }
 enum {
   Playback_menu_midi_bclock = 1,
+#ifdef FEAT_PORTMIDI
+  Playback_menu_clock_input,
+#endif
 };
 static void push_playback_menu(bool midi_bclock_enabled) {
   Qmenu *qm = qmenu_create(Playback_menu_id);
   qmenu_set_title(qm, "Clock & Timing");
   qmenu_add_printf(qm, Playback_menu_midi_bclock, "[%c] Send MIDI Beat Clock",
                    midi_bclock_enabled ? '*' : ' ');
+#ifdef FEAT_PORTMIDI
+  qmenu_add_choice(qm, Playback_menu_clock_input, "MIDI Clock Input...");
+#endif
   qmenu_push_to_nav(qm);
 }
 static void push_about_msg(void) {
@@ -2344,7 +2711,8 @@ static void push_opers_guide_msg(void) {
       {'$', "scale", "Outputs note base on root, scale, degree."},
       {'%', "mono", "Sends MIDI monophonic note."},
       {'=', "midichord", "Sends preset chords over MIDI."},
-      // {';', "udp", "Sends UDP message."},
+      {'^', "osc", "Sends OSC message."},
+      {'|', "udp", "Sends UDP message."},
       {';', "arpeggiator", "Outputs degree numbers for Scale operator."},
       {'&', "bouncer", "A rudimentary LFO-like operator."}
       };
@@ -2385,6 +2753,18 @@ staticni bool try_save_with_msg(Field *field, oso const *str) {
   }
   return ok;
 }
+// Saves a copy of the grid, taken with the Ged lock held, so that the clock
+// doesn't have to wait on the disk. Call without the Ged lock held.
+staticni bool ged_try_save_with_msg(Ged *a, oso const *str) {
+  Field copy;
+  field_init(&copy);
+  ged_lock(a);
+  field_copy(&a->field, &copy);
+  ged_unlock(a);
+  bool ok = try_save_with_msg(&copy, str);
+  field_deinit(&copy);
+  return ok;
+}
 static void push_save_as_form(char const *initial) {
   qform_single_line_input(Save_as_form_id, "Save As", initial);
 }
@@ -2413,7 +2793,6 @@ staticni void push_portmidi_output_device_menu(Midi_mode const *midi_mode) {
                      Pm_GetErrorText(e));
     return;
   }
-  int num = Pm_CountDevices();
   int output_devices = 0;
   int cur_dev_id = 0;
   bool has_cur_dev_id = false;
@@ -2421,6 +2800,8 @@ staticni void push_portmidi_output_device_menu(Midi_mode const *midi_mode) {
     cur_dev_id = midi_mode->portmidi.device_id;
     has_cur_dev_id = true;
   }
+  portmidi_lock();
+  int num = Pm_CountDevices();
   for (int i = 0; i < num; ++i) {
     PmDeviceInfo const *info = Pm_GetDeviceInfo(i);
     if (!info || !info->output)
@@ -2430,6 +2811,7 @@ staticni void push_portmidi_output_device_menu(Midi_mode const *midi_mode) {
                      info->name);
     ++output_devices;
   }
+  portmidi_unlock();
   if (output_devices == 0) {
     qmenu_destroy(qm);
     qmsg_printf_push("No PortMidi Devices",
@@ -2441,6 +2823,41 @@ staticni void push_portmidi_output_device_menu(Midi_mode const *midi_mode) {
   }
   qmenu_push_to_nav(qm);
 }
+// Menu item ids can't be 0, so the devices are offset.
+enum {
+  Clock_input_menu_internal = 1,
+  Clock_input_menu_first_device,
+};
+staticni void push_portmidi_clock_input_menu(Midi_clock_in const *input) {
+  Qmenu *qm = qmenu_create(Portmidi_clock_input_menu_id);
+  qmenu_set_title(qm, "MIDI Clock Input");
+  PmError e = portmidi_init_if_necessary();
+  if (e) {
+    qmenu_destroy(qm);
+    qmsg_printf_push("PortMidi Error",
+                     "PortMidi error during initialization:\n%s",
+                     Pm_GetErrorText(e));
+    return;
+  }
+  bool is_following = input->stream != NULL;
+  qmenu_add_printf(qm, Clock_input_menu_internal, "(%c) Internal Clock",
+                   is_following ? ' ' : '*');
+  portmidi_lock();
+  int num = Pm_CountDevices();
+  for (int i = 0; i < num; ++i) {
+    PmDeviceInfo const *info = Pm_GetDeviceInfo(i);
+    if (!info || !info->input)
+      continue;
+    bool is_cur_dev_id = is_following && input->device_id == i;
+    qmenu_add_printf(qm, Clock_input_menu_first_device + i, "(%c) #%d - %s",
+                     is_cur_dev_id ? '*' : ' ', i, info->name);
+  }
+  portmidi_unlock();
+  if (is_following)
+    qmenu_set_current_item(qm,
+                           Clock_input_menu_first_device + input->device_id);
+  qmenu_push_to_nav(qm);
+}
 #endif
 
 staticni bool read_int(char const *str, int *out) {
@@ -2522,13 +2939,16 @@ static char const *const conf_file_name = "orca.conf";
 #define CONFOPT_ENUM(x) Confopt_##x,
 #define CONFOPTS(_)                                                            \
   _(portmidi_output_device)                                                    \
+  _(portmidi_clock_input_device)                                               \
   _(osc_output_address)                                                        \
   _(osc_output_port)                                                           \
   _(osc_output_enabled)                                                        \
   _(midi_beat_clock)                                                           \
   _(margins)                                                                   \
   _(grid_dot_type)                                                             \
-  _(grid_ruler_type)
+  _(grid_ruler_type)                                                           \
+  _(max_fps)                                                                   \
+  _(renderer)
 char const *const confopts[] = {CONFOPTS(CONFOPT_STRING)};
 enum { Confoptslen = ORCA_ARRAY_COUNTOF(confopts) };
 enum { CONFOPTS(CONFOPT_ENUM) };
@@ -2544,6 +2964,8 @@ enum { CONFOPTS(CONFOPT_ENUM) };
 
 char const *const prefval_plain = "plain";
 char const *const prefval_fancy = "fancy";
+char const *const prefval_curses = "curses";
+char const *const prefval_ansi = "ansi";
 
 staticni bool plainorfancy(char const *val, bool *out) {
   if (strcmp(val, prefval_plain) == 0) {
@@ -2584,9 +3006,14 @@ typedef struct {
   int hardmargin_y, hardmargin_x;
   U32 prefs_touched;
   bool use_gui_cboard; // not bitfields due to taking address of
+  int midi_latency;
   bool strict_timing;
   bool osc_output_enabled;
   bool fancy_grid_dots, fancy_grid_rulers;
+  bool no_render;
+  bool ansi_render; // Draw the grid with Term_ansi instead of doupdate()
+  int max_fps;      // Redraws per second at most. 0 for no limit
+  Term_ansi term_ansi;
 } Tui;
 
 ORCA_OK_IF_UNUSED staticni void print_loading_message(char const *s) {
@@ -2604,8 +3031,8 @@ ORCA_OK_IF_UNUSED staticni void print_loading_message(char const *s) {
 }
 
 staticni void tui_load_conf(Tui *t) {
-  oso *portmidi_output_device = NULL, *osc_output_address = NULL,
-      *osc_output_port = NULL;
+  oso *portmidi_output_device = NULL, *portmidi_clock_input_device = NULL,
+      *osc_output_address = NULL, *osc_output_port = NULL;
   U32 touched = 0;
   Ezconf_r ez;
   for (ezconf_r_start(&ez, conf_file_name);
@@ -2614,6 +3041,10 @@ staticni void tui_load_conf(Tui *t) {
     case Confopt_portmidi_output_device:
       osoput(&portmidi_output_device, ez.value);
       break;
+    case Confopt_portmidi_clock_input_device:
+      osoput(&portmidi_clock_input_device, ez.value);
+      touched |= TOUCHFLAG(Confopt_portmidi_clock_input_device);
+      break;
     case Confopt_osc_output_address: {
       // Don't actually allocate heap string if string is empty
       Usz len = strlen(ez.value);
@@ -2669,6 +3100,24 @@ staticni void tui_load_conf(Tui *t) {
       }
       break;
     }
+    case Confopt_max_fps: {
+      int max_fps;
+      if (read_int(ez.value, &max_fps) && max_fps >= 0) {
+        t->max_fps = max_fps;
+        touched |= TOUCHFLAG(Confopt_max_fps);
+      }
+      break;
+    }
+    case Confopt_renderer: {
+      if (strcmp(ez.value, prefval_ansi) == 0)
+        t->ansi_render = true;
+      else if (strcmp(ez.value, prefval_curses) == 0)
+        t->ansi_render = false;
+      else
+        break;
+      touched |= TOUCHFLAG(Confopt_renderer);
+      break;
+    }
     }
   }
 
@@ -2695,18 +3144,30 @@ staticni void tui_load_conf(Tui *t) {
     PmError pmerr;
     PmDeviceID devid;
     if (portmidi_find_device_id_by_name(osoc(portmidi_output_device),
-                                        osolen(portmidi_output_device), &pmerr,
-                                        &devid)) {
+                                        osolen(portmidi_output_device), false,
+                                        &pmerr, &devid)) {
       midi_mode_deinit(&t->ged.midi_mode);
-      pmerr = midi_mode_init_portmidi(&t->ged.midi_mode, devid);
+      pmerr = midi_mode_init_portmidi(&t->ged.midi_mode, devid,
+                                       t->midi_latency);
       if (pmerr) {
         // todo stuff
       }
     }
   }
+  if (osolen(portmidi_clock_input_device)) {
+    print_loading_message("Waiting on PortMidi...");
+    PmError pmerr;
+    PmDeviceID devid;
+    if (portmidi_find_device_id_by_name(osoc(portmidi_clock_input_device),
+                                        osolen(portmidi_clock_input_device),
+                                        true, &pmerr, &devid))
+      midi_clock_in_open(&t->ged.clock.input, devid,
+                         t->ged.clock.input_wake_fds[1]);
+  }
 #endif
   t->prefs_touched |= touched;
   osofree(portmidi_output_device);
+  osofree(portmidi_clock_input_device);
   osofree(osc_output_address);
   osofree(osc_output_port);
 }
@@ -2726,7 +3187,8 @@ staticni void tui_save_prefs(Tui *t) {
   case Midi_mode_type_portmidi: {
     PmError pmerror;
     if (!portmidi_find_name_of_device_id(t->ged.midi_mode.portmidi.device_id,
-                                         &pmerror, &midi_output_device_name) ||
+                                         false, &pmerror,
+                                         &midi_output_device_name) ||
         osolen(midi_output_device_name) < 1) {
       osowipe(&midi_output_device_name);
       break;
@@ -2737,13 +3199,29 @@ staticni void tui_save_prefs(Tui *t) {
   }
 #endif
   }
+  oso *clock_input_device_name = NULL;
+#ifdef FEAT_PORTMIDI
+  if (t->ged.clock.input.stream) {
+    PmError pmerror;
+    if (!portmidi_find_name_of_device_id(t->ged.clock.input.device_id, true,
+                                         &pmerror, &clock_input_device_name))
+      osowipe(&clock_input_device_name);
+  }
+  // Written out empty after going back to the internal clock, so that the old
+  // device isn't picked up again on the next start.
+  if (osolen(clock_input_device_name) > 0 ||
+      (t->prefs_touched & TOUCHFLAG(Confopt_portmidi_clock_input_device)))
+    ezconf_w_addopt(&ez, confopts[Confopt_portmidi_clock_input_device],
+                    Confopt_portmidi_clock_input_device);
+#endif
   // Add all conf items touched by user that we want to write to config file.
   // "Touched" items include conf items that were present on disk when we first
   // loaded the config file, plus the items that the user has modified by
   // interacting with the menus.
   for (int i = 0; i < Confoptslen; i++) {
-    if (i == Confopt_portmidi_output_device)
-      // This has its own special logic
+    if (i == Confopt_portmidi_output_device ||
+        i == Confopt_portmidi_clock_input_device)
+      // These have their own special logic
       continue;
     if (t->prefs_touched & TOUCHFLAG(i))
       ezconf_w_addopt(&ez, confopts[i], i);
@@ -2766,6 +3244,10 @@ staticni void tui_save_prefs(Tui *t) {
     case Confopt_portmidi_output_device:
       fputs(osoc(midi_output_device_name), ez.file);
       break;
+    case Confopt_portmidi_clock_input_device:
+      if (osolen(clock_input_device_name))
+        fputs(osoc(clock_input_device_name), ez.file);
+      break;
 #endif
     case Confopt_midi_beat_clock:
       fputc(t->ged.midi_bclock ? '1' : '0', ez.file);
@@ -2779,9 +3261,16 @@ staticni void tui_save_prefs(Tui *t) {
     case Confopt_grid_ruler_type:
       fputs(t->fancy_grid_rulers ? prefval_fancy : prefval_plain, ez.file);
       break;
+    case Confopt_max_fps:
+      fprintf(ez.file, "%d", t->max_fps);
+      break;
+    case Confopt_renderer:
+      fputs(t->ansi_render ? prefval_ansi : prefval_curses, ez.file);
+      break;
     }
   }
   osofree(midi_output_device_name);
+  osofree(clock_input_device_name);
   if (ez.error) {
     char const *msg = ezconf_w_errorstring(ez.error);
     qmsg_printf_push("Config Error",
@@ -2901,6 +3390,7 @@ staticni void tui_adjust_term_size(Tui *t, WINDOW **cont_window) {
       delwin(*cont_window);
     wclear(stdscr);
     *cont_window = derwin(stdscr, content_h, content_w, content_y, content_x);
+    t->ged.grid_drawn.is_valid = false;
     t->ged.is_draw_dirty = true;
   }
   // OK to call this unconditionally -- deriving the sub-window areas is
@@ -2911,9 +3401,49 @@ staticni void tui_adjust_term_size(Tui *t, WINDOW **cont_window) {
                       t->softmargin_x);
 }
 
+// Pastes from the GUI clipboard at the cursor, falling back to the internal
+// clipboard if that doesn't work. Reading the GUI clipboard waits on another
+// program, so the text is first pasted into a separate buffer without the Ged
+// lock held, and then copied into the grid. Call without the Ged lock held.
+staticni void tui_paste_from_gui_clipboard(Tui *t) {
+  Ged *a = &t->ged;
+  Usz field_h = a->field.height, field_w = a->field.width;
+  Usz curs_y = a->ged_cursor.y, curs_x = a->ged_cursor.x;
+  // Cells that the paste doesn't write to, like where there were spaces, stay
+  // 0, which isn't a glyph.
+  Field pasted;
+  field_init_fill(&pasted, field_h, field_w, 0);
+  Usz pasted_h, pasted_w;
+  Cboard_error cberr = cboard_paste(pasted.buffer, field_h, field_w, curs_y,
+                                    curs_x, &pasted_h, &pasted_w);
+  ged_lock(a);
+  if (cberr) {
+    t->use_gui_cboard = false;
+    ged_input_cmd(a, Ged_input_cmd_paste);
+  } else if (curs_y < field_h && curs_x < field_w) {
+    undo_history_push(&a->undo_hist, &a->field, a->tick_num);
+    for (Usz iy = curs_y; iy < curs_y + pasted_h; ++iy) {
+      for (Usz ix = curs_x; ix < curs_x + pasted_w; ++ix) {
+        Glyph g = pasted.buffer[iy * field_w + ix];
+        if (g)
+          a->field.buffer[iy * field_w + ix] = g;
+      }
+    }
+    oper_index_update_rect(&a->vm.oper_index, a->field.buffer, field_h,
+                           field_w, curs_y, curs_x, pasted_h, pasted_w);
+    a->ged_cursor.h = pasted_h;
+    a->ged_cursor.w = pasted_w;
+    a->needs_remarking = true;
+    a->is_draw_dirty = true;
+  }
+  ged_unlock(a);
+  field_deinit(&pasted);
+}
+
+// Call without the Ged lock held.
 static void tui_try_save(Tui *t) {
   if (osolen(t->file_name) > 0)
-    try_save_with_msg(&t->ged.field, t->file_name);
+    ged_try_save_with_msg(&t->ged, t->file_name);
   else
     push_save_as_form("");
 }
@@ -2924,6 +3454,7 @@ typedef enum {
   Tui_menus_consumed_input,
 } Tui_menus_result;
 
+// Call without the Ged lock held.
 staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
   Qblock *qb = qnav_top_block();
   if (!qb)
@@ -2994,9 +3525,13 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
         case Main_menu_save_as:
           push_save_as_form(osoc(t->file_name));
           break;
-        case Main_menu_set_tempo:
-          push_set_tempo_form(t->ged.bpm);
+        case Main_menu_set_tempo: {
+          ged_lock(&t->ged);
+          Usz bpm = t->ged.bpm;
+          ged_unlock(&t->ged);
+          push_set_tempo_form(bpm);
           break;
+        }
         case Main_menu_set_grid_dims:
           push_set_grid_dims_form(t->ged.field.height, t->ged.field.width);
           break;
@@ -3024,9 +3559,12 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
           break;
         }
         if (did_get_ok_size) {
+          ged_lock(&t->ged);
           ged_resize_grid(&t->ged.field, &t->ged.mbuf_r, new_field_h,
                           new_field_w, t->ged.tick_num, &t->ged.scratch_field,
                           &t->ged.undo_hist, &t->ged.ged_cursor);
+          oper_index_invalidate(&t->ged.vm.oper_index);
+          ged_unlock(&t->ged);
           ged_update_internal_geometry(&t->ged);
           t->ged.needs_remarking = true;
           t->ged.is_draw_dirty = true;
@@ -3045,13 +3583,17 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
           Usz new_field_h, new_field_w;
           if (tui_suggest_nice_grid_size(t, t->ged.win_h, t->ged.win_w,
                                          &new_field_h, &new_field_w)) {
+            ged_lock(&t->ged);
             undo_history_push(&t->ged.undo_hist, &t->ged.field,
                               t->ged.tick_num);
             field_resize_raw(&t->ged.field, new_field_h, new_field_w);
             memset(t->ged.field.buffer, '.',
                    new_field_h * new_field_w * sizeof(Glyph));
-            ged_cursor_confine(&t->ged.ged_cursor, new_field_h, new_field_w);
             mbuf_reusable_ensure_size(&t->ged.mbuf_r, new_field_h, new_field_w);
+            orca_vm_reset(&t->ged.vm);
+            oper_index_invalidate(&t->ged.vm.oper_index);
+            ged_unlock(&t->ged);
+            ged_cursor_confine(&t->ged.ged_cursor, new_field_h, new_field_w);
             ged_update_internal_geometry(&t->ged);
             ged_make_cursor_visible(&t->ged);
             t->ged.needs_remarking = true;
@@ -3083,6 +3625,7 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
         switch (act.picked.id) {
         case Playback_menu_midi_bclock: {
           bool new_enabled = !t->ged.midi_bclock;
+          ged_lock(&t->ged);
           t->ged.midi_bclock = new_enabled;
           if (t->ged.is_playing) {
             int msgbyte = new_enabled ? 0xFA /* start */ : 0xFC /* stop */;
@@ -3093,12 +3636,18 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
             // current remaining time from the reference clock point into the
             // accum time, and mutiply or divide it.
           }
+          ged_unlock(&t->ged);
           t->prefs_touched |= TOUCHFLAG(Confopt_midi_beat_clock);
           qnav_stack_pop();
           push_playback_menu(new_enabled);
           tui_save_prefs(t);
           break;
         }
+#ifdef FEAT_PORTMIDI
+        case Playback_menu_clock_input:
+          push_portmidi_clock_input_menu(&t->ged.clock.input);
+          break;
+#endif
         }
         break;
       case Set_fancy_grid_dots_menu_id:
@@ -3135,9 +3684,12 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
         break;
 #ifdef FEAT_PORTMIDI
       case Portmidi_output_device_menu_id: {
+        ged_lock(&t->ged);
         ged_stop_all_sustained_notes(&t->ged);
         midi_mode_deinit(&t->ged.midi_mode);
-        PmError pme = midi_mode_init_portmidi(&t->ged.midi_mode, act.picked.id);
+        PmError pme = midi_mode_init_portmidi(&t->ged.midi_mode,
+                                              act.picked.id, t->midi_latency);
+        ged_unlock(&t->ged);
         qnav_stack_pop();
         if (pme) {
           qmsg_printf_push("PortMidi Error",
@@ -3148,6 +3700,33 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
         }
         break;
       }
+      case Portmidi_clock_input_menu_id: {
+        // The clock thread takes events from the input with the Ged lock
+        // held, so it can be swapped out from here. Its reading thread never
+        // takes the Ged lock, so stopping it with the lock held is fine.
+        Midi_clock_in *input = &t->ged.clock.input;
+        PmError pme = pmNoError;
+        ged_lock(&t->ged);
+        if (act.picked.id == Clock_input_menu_internal)
+          midi_clock_in_deinit(input);
+        else
+          pme = midi_clock_in_open(
+              input, act.picked.id - Clock_input_menu_first_device,
+              t->ged.clock.input_wake_fds[1]);
+        t->ged.clock.input_bpm = 0.0;
+        ged_clock_signal(&t->ged.clock);
+        ged_unlock(&t->ged);
+        qnav_stack_pop();
+        if (pme) {
+          qmsg_printf_push("PortMidi Error",
+                           "Error opening MIDI clock input device:\n%s",
+                           Pm_GetErrorText(pme));
+        } else {
+          t->prefs_touched |= TOUCHFLAG(Confopt_portmidi_clock_input_device);
+          tui_save_prefs(t);
+        }
+        break;
+      }
 #endif
       }
       break;
@@ -3171,15 +3750,25 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
           expand_home_tilde(&temp_name);
           if (!temp_name)
             break;
-          bool added_hist = undo_history_push(&t->ged.undo_hist, &t->ged.field,
-                                              t->ged.tick_num);
-          Field_load_error fle =
-              field_load_file(osoc(temp_name), &t->ged.field);
+          // Loaded into a separate field without the Ged lock held, and only
+          // swapped in once it's read.
+          Field loaded;
+          field_init(&loaded);
+          Field_load_error fle = field_load_file(osoc(temp_name), &loaded);
           if (fle == Field_load_error_ok) {
             qnav_stack_pop();
             osoputoso(&t->file_name, temp_name);
+            ged_lock(&t->ged);
+            undo_history_push(&t->ged.undo_hist, &t->ged.field,
+                              t->ged.tick_num);
+            Field old = t->ged.field;
+            t->ged.field = loaded;
+            loaded = old;
+            oper_index_invalidate(&t->ged.vm.oper_index);
+            orca_vm_reset(&t->ged.vm);
             mbuf_reusable_ensure_size(&t->ged.mbuf_r, t->ged.field.height,
                                       t->ged.field.width);
+            ged_unlock(&t->ged);
             ged_cursor_confine(&t->ged.ged_cursor, t->ged.field.height,
                                t->ged.field.width);
             ged_update_internal_geometry(&t->ged);
@@ -3188,12 +3777,10 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
             t->ged.is_draw_dirty = true;
             pop_qnav_if_main_menu();
           } else {
-            if (added_hist)
-              undo_history_pop(&t->ged.undo_hist, &t->ged.field,
-                               &t->ged.tick_num);
             qmsg_printf_push("Error Loading File", "%s:\n%s", osoc(temp_name),
                              field_load_error_string(fle));
           }
+          field_deinit(&loaded);
           osofree(temp_name);
           break;
         }
@@ -3202,7 +3789,7 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
           if (!temp_name)
             break;
           qnav_stack_pop();
-          bool saved_ok = try_save_with_msg(&t->ged.field, temp_name);
+          bool saved_ok = ged_try_save_with_msg(&t->ged, temp_name);
           if (saved_ok)
             osoputoso(&t->file_name, temp_name);
           osofree(temp_name);
@@ -3214,7 +3801,9 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
             break;
           int newbpm = atoi(osoc(tmpstr));
           if (newbpm > 0) {
+            ged_lock(&t->ged);
             t->ged.bpm = (Usz)newbpm;
+            ged_unlock(&t->ged);
             qnav_stack_pop();
           }
           osofree(tmpstr);
@@ -3258,10 +3847,13 @@ staticni Tui_menus_result tui_drive_menus(Tui *t, int key) {
               newwidth < ORCA_X_MAX) {
             if (t->ged.field.height != (Usz)newheight ||
                 t->ged.field.width != (Usz)newwidth) {
+              ged_lock(&t->ged);
               ged_resize_grid(&t->ged.field, &t->ged.mbuf_r, (Usz)newheight,
                               (Usz)newwidth, t->ged.tick_num,
                               &t->ged.scratch_field, &t->ged.undo_hist,
                               &t->ged.ged_cursor);
+              oper_index_invalidate(&t->ged.vm.oper_index);
+              ged_unlock(&t->ged);
               ged_update_internal_geometry(&t->ged);
               t->ged.needs_remarking = true;
               t->ged.is_draw_dirty = true;
@@ -3315,8 +3907,12 @@ enum {
   Argopt_init_grid_size,
   Argopt_osc_midi_bidule,
   Argopt_strict_timing,
+  Argopt_midi_latency,
+  Argopt_cc_rate,
+  Argopt_osc_lookahead,
   Argopt_bpm,
   Argopt_seed,
+  Argopt_no_render,
   Argopt_portmidi_deprecated,
   Argopt_osc_deprecated,
 };
@@ -3329,8 +3925,12 @@ int main(int argc, char **argv) {
       {"help", no_argument, 0, 'h'},
       {"osc-midi-bidule", required_argument, 0, Argopt_osc_midi_bidule},
       {"strict-timing", no_argument, 0, Argopt_strict_timing},
+      {"midi-latency", required_argument, 0, Argopt_midi_latency},
+      {"cc-rate", required_argument, 0, Argopt_cc_rate},
+      {"osc-lookahead", required_argument, 0, Argopt_osc_lookahead},
       {"bpm", required_argument, 0, Argopt_bpm},
       {"seed", required_argument, 0, Argopt_seed},
+      {"no-render", no_argument, 0, Argopt_no_render},
       {"portmidi-list-devices", no_argument, 0, Argopt_portmidi_deprecated},
       {"portmidi-output-device", required_argument, 0,
        Argopt_portmidi_deprecated},
@@ -3339,6 +3939,8 @@ int main(int argc, char **argv) {
       {NULL, 0, NULL, 0}};
   int init_bpm = 120;
   int init_seed = 1;
+  int cc_rate = 1000;
+  int osc_lookahead = -1;
   int init_grid_dim_y = 25, init_grid_dim_x = 57;
   bool explicit_initial_grid_size = false;
 
@@ -3349,6 +3951,9 @@ int main(int argc, char **argv) {
   t.use_gui_cboard = true;
   t.fancy_grid_dots = true;
   t.fancy_grid_rulers = true;
+  t.midi_latency = Portmidi_default_latency;
+  t.max_fps = 60;
+  term_ansi_init(&t.term_ansi, STDOUT_FILENO);
 
   int longindex = 0;
   for (;;) {
@@ -3404,6 +4009,21 @@ int main(int argc, char **argv) {
     case Argopt_strict_timing:
       t.strict_timing = true;
       break;
+    case Argopt_no_render:
+      t.no_render = true;
+      break;
+    case Argopt_midi_latency:
+      if (read_int(optarg, &t.midi_latency) && t.midi_latency >= 0)
+        break;
+      OPTFAIL("Must be 0 or positive integer.");
+    case Argopt_cc_rate:
+      if (read_int(optarg, &cc_rate) && cc_rate >= 0)
+        break;
+      OPTFAIL("Must be 0 or positive integer.");
+    case Argopt_osc_lookahead:
+      if (read_int(optarg, &osc_lookahead) && osc_lookahead >= 0)
+        break;
+      OPTFAIL("Must be 0 or positive integer.");
     case Argopt_portmidi_deprecated:
       fprintf(stderr,
               "Option \"--%s\" has been removed.\nInstead, choose "
@@ -3430,12 +4050,17 @@ int main(int argc, char **argv) {
   qnav_init(); // Initialize the menu/navigation global state
   // Initialize the 'Grid EDitor' stuff. This sits underneath the TUI.
   ged_init(&t.ged, (Usz)t.undo_history_limit, (Usz)init_bpm, (Usz)init_seed);
+  if (cc_rate > 0)
+    t.ged.cc_ramp_period = UINT64_C(1000000000) / (U64)cc_rate;
+  if (osc_lookahead >= 0) {
+    t.ged.osc_timetags = true;
+    t.ged.osc_lookahead = (U64)osc_lookahead * UINT64_C(1000000);
+  }
   // This will need to be changed to work with conf/menu
   if (osolen(t.osc_midi_bidule_path) > 0) {
     midi_mode_deinit(&t.ged.midi_mode);
     midi_mode_init_osc_bidule(&t.ged.midi_mode, osoc(t.osc_midi_bidule_path));
   }
-  stm_setup(); // Set up timer lib
   // Enable UTF-8 by explicitly initializing our locale before initializing
   // ncurses. Only needed (maybe?) if using libncursesw/wide-chars or UTF-8.
   // Using it unguarded will mess up box drawing chars in Linux virtual
@@ -3467,8 +4092,7 @@ int main(int argc, char **argv) {
   tui_load_conf(&t);                  // load orca.conf (if it exists)
   tui_restart_osc_udp_if_enabled(&t); // start udp if conf enabled it
 
-  wtimeout(stdscr, 0);
-  int cur_timeout = 0;
+  wtimeout(stdscr, 0); // We wait for input in poll() instead.
   Usz brackpaste_starting_x = 0, brackpaste_y = 0, brackpaste_x = 0,
       brackpaste_max_y = 0, brackpaste_max_x = 0;
   bool is_in_brackpaste = false;
@@ -3521,81 +4145,96 @@ int main(int argc, char **argv) {
                             t.ged.field.width);
   ged_make_cursor_visible(&t.ged);
   ged_send_osc_bpm(&t.ged, (I32)t.ged.bpm); // Send initial BPM
-  ged_set_playing(&t.ged, true);            // Auto-play
+  // Copying the grid into a frame after every step is wasted work when it's
+  // never drawn, and with big grids and fast tempos it adds up.
+  t.ged.clock.publish_frames = !t.no_render;
+  {
+    int err = ged_clock_start(&t.ged, t.strict_timing);
+    if (err)
+      qmsg_printf_push("Strict Timing",
+                       "Couldn't set real-time scheduling for the clock:\n%s",
+                       strerror(err));
+  }
+  ged_lock(&t.ged);
+  ged_set_playing(&t.ged, true); // Auto-play
+  ged_unlock(&t.ged);
+  U64 const frame_period =
+      t.max_fps > 0 ? UINT64_C(1000000000) / (U64)t.max_fps : 0;
+  U64 last_draw_time = 0;
+  bool is_drawing_ansi = false;
+  if (t.no_render)
+    print_loading_message("Not drawing (--no-render). Ctrl+Q quits.");
   // Enter main loop. Process events as they arrive.
 event_loop:;
   int key = wgetch(stdscr);
-  if (cur_timeout != 0) {
-    wtimeout(stdscr, 0); // Until we run out, don't wait between events.
-    cur_timeout = 0;
-  }
   switch (key) {
   case ERR: { // ERR indicates no more events.
-    ged_do_stuff(&t.ged);
+    // Redraws are held back until a frame period has passed since the last
+    // one. Whatever changed in the meantime, from steps or from input, gets
+    // drawn together then, since the newest published frame is always the one
+    // that's taken.
+    U64 now = midi_clock_now_ns();
+    int wait_ms = 50;
+    if (t.no_render)
+      goto wait;
+    if (now - last_draw_time < frame_period) {
+      U64 left = frame_period - (now - last_draw_time);
+      wait_ms = (int)((left + UINT64_C(999999)) / UINT64_C(1000000));
+      goto wait;
+    }
+    bool is_dirty = ged_is_draw_dirty(&t.ged);
+    if (is_dirty) {
+      ged_lock(&t.ged);
+      ged_prepare_draw(&t.ged);
+      ged_unlock(&t.ged);
+    }
+    bool is_new_frame;
+    Ged_frame const *frame = ged_take_frame(&t.ged, &is_new_frame);
+    // The menus are curses pads, so while any are open, everything is drawn
+    // with curses. Neither knows what the other put on the screen, so the
+    // first frame after switching between them is drawn in full.
+    bool use_ansi = t.ansi_render && !qnav_top_block();
+    bool is_switching = use_ansi != is_drawing_ansi;
+    if (is_switching) {
+      if (use_ansi) {
+        term_ansi_invalidate(&t.term_ansi);
+      } else {
+        // Most of the grid went straight to the terminal, so it isn't in the
+        // window. Drawing it in full again touches the whole window.
+        clearok(curscr, TRUE);
+        t.ged.grid_drawn.is_valid = false;
+      }
+      is_drawing_ansi = use_ansi;
+    }
     bool drew_any = false;
-    if (ged_is_draw_dirty(&t.ged) || qnav_stack.occlusion_dirty) {
-      werase(cont_window);
-      ged_draw(&t.ged, cont_window, osoc(t.file_name), t.fancy_grid_dots,
-               t.fancy_grid_rulers);
-      wnoutrefresh(cont_window);
+    if (is_new_frame || is_dirty || is_switching ||
+        qnav_stack.occlusion_dirty) {
+      // Lines of the window that weren't drawn on this time still have to be
+      // copied out again if a menu over them went away.
+      if (qnav_stack.occlusion_dirty)
+        touchwin(cont_window);
+      ged_draw(&t.ged, frame, cont_window, use_ansi ? &t.term_ansi : NULL,
+               osoc(t.file_name), t.fancy_grid_dots, t.fancy_grid_rulers);
+      if (!use_ansi)
+        wnoutrefresh(cont_window);
       drew_any = true;
     }
     drew_any |= qnav_draw(); // clears qnav_stack.occlusion_dirty
-    if (drew_any)
-      doupdate();
-    double secs_to_d = ged_secs_to_deadline(&t.ged);
-#define DEADTIME(_millisecs, _new_timeout)                                     \
-  else if (secs_to_d < ms_to_sec(_millisecs)) new_timeout = _new_timeout;
-    int new_timeout;
-    // These values are tuned to work OK with the normal scheduling behavior
-    // on Linux, Mac, and Windows. All of the usual caveats of trying to
-    // guess what the scheduler will do apply.
-    //
-    // Of course, there's no guarantee about how the scheduler will work, so
-    // if you are using a modified kernel or something, or the measurements
-    // here are bad, or it's some OS that behaves differently than expected,
-    // this won't be very good. But there's not really much we can do about
-    // it, and it's better than doing nothing and burning up the CPU!
-    if (t.strict_timing) { // clang-format off
-      if (false) {}
-      // "If there's less than 1.5 milliseconds to the deadline, use a curses
-      // timeout value of 0."
-      DEADTIME(  1.5,  0)
-      DEADTIME(  3.0,  1)
-      DEADTIME(  5.0,  2)
-      DEADTIME(  7.0,  3)
-      DEADTIME(  9.0,  4)
-      DEADTIME( 11.0,  5)
-      DEADTIME( 13.0,  6)
-      DEADTIME( 15.0,  7)
-      DEADTIME( 25.0, 12)
-      DEADTIME( 50.0, 20)
-      DEADTIME(100.0, 40)
-      else new_timeout = 50;
-    } else {
-      if (false) {}
-      DEADTIME(  1.0,  0)
-      DEADTIME(  2.0,  1)
-      DEADTIME(  7.0,  2)
-      DEADTIME( 15.0,  5)
-      DEADTIME( 25.0, 10)
-      DEADTIME( 50.0, 20)
-      DEADTIME(100.0, 40)
-      else new_timeout = 50;
-    } // clang-format on
-#undef DEADTIME
-    if (new_timeout != cur_timeout) {
-      wtimeout(stdscr, new_timeout);
-      cur_timeout = new_timeout;
-#if TIME_DEBUG
-      spin_track_timeout = cur_timeout;
-#endif
+    if (drew_any) {
+      if (use_ansi)
+        term_ansi_flush(&t.term_ansi);
+      else
+        doupdate();
+      last_draw_time = now;
     }
+  wait:
+    ged_clock_wait(&t.ged, wait_ms);
     goto event_loop;
   }
   case KEY_RESIZE:
     tui_adjust_term_size(&t, &cont_window);
     qnav_adjust_term_size();
+    term_ansi_invalidate(&t.term_ansi);
     goto event_loop;
 #ifndef FEAT_NOMOUSE
   case KEY_MOUSE: {
@@ -3666,8 +4305,12 @@ event_loop:;
           cleaned = '.';
         if (brackpaste_y < t.ged.field.height &&
             brackpaste_x < t.ged.field.width) {
+          ged_lock(&t.ged);
           gbuffer_poke(t.ged.field.buffer, t.ged.field.height,
                        t.ged.field.width, brackpaste_y, brackpaste_x, cleaned);
+          oper_index_update_cell(&t.ged.vm.oper_index, brackpaste_y, brackpaste_x,
+                                 (Glyph)cleaned);
+          ged_unlock(&t.ged);
           // Could move this out one level if we wanted the final selection
           // size to reflect even the pasted area which didn't fit on the
           // grid.
@@ -3682,7 +4325,9 @@ event_loop:;
     goto event_loop;
   }
 
-  // Regular inputs when we're not in a menu and not in bracketed paste.
+  // Regular inputs when we're not in a menu and not in bracketed paste. These
+  // ones wait on files or on other programs, and take the Ged lock themselves
+  // only for as long as they need it.
   switch (key) {
   // Checking again for 'quit' here, because it's only listened for if we're
   // in the menus or *not* in bracketed paste mode.
@@ -3690,7 +4335,21 @@ event_loop:;
     goto quit;
   case CTRL_PLUS('o'):
     push_open_form(osoc(t.file_name));
+    goto event_loop;
+  case CTRL_PLUS('s'):
+    tui_try_save(&t);
+    goto event_loop;
+  case CTRL_PLUS('v'):
+    if (t.use_gui_cboard) {
+      tui_paste_from_gui_clipboard(&t);
+      goto event_loop;
+    }
     break;
+  }
+  // The rest are edits, and are handled with the Ged lock held.
+  bool is_cboard_changed = false;
+  ged_lock(&t.ged);
+  switch (key) {
   case 127: // backspace in terminal.app, apparently
   case KEY_BACKSPACE:
     if (t.ged.input_mode == Ged_input_mode_append) {
@@ -3709,7 +4368,7 @@ event_loop:;
     t.ged.tick_num = 0;
     t.ged.needs_remarking = true;
     t.ged.is_draw_dirty = true;
-    reset_last_unique_value(); // Call this to reset the global unique value
+    orca_vm_reset_unique_random(&t.ged.vm);
     break;
   case '[':
     ged_adjust_rulers_relative(&t.ged, 0, -1);
@@ -3764,36 +4423,14 @@ event_loop:;
     break;
   case CTRL_PLUS('x'):
     ged_input_cmd(&t.ged, Ged_input_cmd_cut);
-    try_send_to_gui_clipboard(&t.ged, &t.use_gui_cboard);
+    is_cboard_changed = true;
     break;
   case CTRL_PLUS('c'):
     ged_input_cmd(&t.ged, Ged_input_cmd_copy);
-    try_send_to_gui_clipboard(&t.ged, &t.use_gui_cboard);
+    is_cboard_changed = true;
     break;
   case CTRL_PLUS('v'):
-    if (t.use_gui_cboard) {
-      bool added_hist =
-          undo_history_push(&t.ged.undo_hist, &t.ged.field, t.ged.tick_num);
-      Usz pasted_h, pasted_w;
-      Cboard_error cberr = cboard_paste(
-          t.ged.field.buffer, t.ged.field.height, t.ged.field.width,
-          t.ged.ged_cursor.y, t.ged.ged_cursor.x, &pasted_h, &pasted_w);
-      if (cberr) {
-        if (added_hist)
-          undo_history_pop(&t.ged.undo_hist, &t.ged.field, &t.ged.tick_num);
-        t.use_gui_cboard = false;
-        ged_input_cmd(&t.ged, Ged_input_cmd_paste);
-      } else {
-        if (pasted_h > 0 && pasted_w > 0) {
-          t.ged.ged_cursor.h = pasted_h;
-          t.ged.ged_cursor.w = pasted_w;
-        }
-      }
-      t.ged.needs_remarking = true;
-      t.ged.is_draw_dirty = true;
-    } else {
-      ged_input_cmd(&t.ged, Ged_input_cmd_paste);
-    }
+    ged_input_cmd(&t.ged, Ged_input_cmd_paste);
     break;
   case '\'':
     ged_input_cmd(&t.ged, Ged_input_cmd_toggle_selresize_mode);
@@ -3911,9 +4548,6 @@ event_loop:;
   case CTRL_PLUS('g'):
     push_opers_guide_msg();
     break;
-  case CTRL_PLUS('s'):
-    tui_try_save(&t);
-    break;
 
   default:
     if (key >= CHAR_MIN && key <= CHAR_MAX && orca_is_valid_glyph((Glyph)key))
@@ -3924,8 +4558,13 @@ event_loop:;
 #endif
     break;
   }
+  ged_unlock(&t.ged);
+  // The clipboard is only used by the UI thread.
+  if (is_cboard_changed)
+    try_send_to_gui_clipboard(&t.ged, &t.use_gui_cboard);
   goto event_loop;
 quit:
+  ged_clock_stop(&t.ged);
   ged_stop_all_sustained_notes(&t.ged);
   qnav_deinit();
   if (cont_window)
@@ -3936,13 +4575,13 @@ quit:
   printf("\033[?2004h\n"); // Tell terminal to not use bracketed paste
   endwin();
   ged_deinit(&t.ged);
+  term_ansi_deinit(&t.term_ansi);
   osofree(t.file_name);
   osofree(t.osc_address);
   osofree(t.osc_port);
   osofree(t.osc_midi_bidule_path);
 #ifdef FEAT_PORTMIDI
-  if (portmidi_is_initialized)
-    Pm_Terminate();
+  portmidi_terminate_if_necessary();
 #endif
 }
 
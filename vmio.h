@@ -47,21 +47,22 @@ typedef struct {
   U8 channel, lsb, msb;
 } Oevent_midi_pb;
 
+// OSC and UDP events are variable length. The numbers or characters follow
+// right after the header in the event list -- see oevent_osc_ints_numbers()
+// and oevent_udp_string_chars().
 enum { Oevent_osc_int_count = 35 };
 
 typedef struct {
   U8 oevent_type;
   Glyph glyph;
-  U8 count;
-  U8 numbers[Oevent_osc_int_count];
+  U8 count; // followed by count numbers, each 0-35
 } Oevent_osc_ints;
 
 enum { Oevent_udp_string_count = 16 };
 
 typedef struct {
   U8 oevent_type;
-  U8 count;
-  char chars[Oevent_udp_string_count];
+  U8 count; // followed by count chars
 } Oevent_udp_string;
 
 typedef union {
@@ -74,9 +75,46 @@ typedef union {
   Oevent_udp_string udp_string;
 } Oevent;
 
+static inline U8 const *oevent_osc_ints_numbers(Oevent_osc_ints const *eo) {
+  return (U8 const *)eo + sizeof *eo;
+}
+static inline char const *
+oevent_udp_string_chars(Oevent_udp_string const *eu) {
+  return (char const *)eu + sizeof *eu;
+}
+
+// Size of the event's record in an Oevent_list, including anything that
+// follows the header.
+static inline Usz oevent_size(Oevent const *e) {
+  switch ((Oevent_types)e->any.oevent_type) {
+  case Oevent_type_midi_note:
+    return sizeof(Oevent_midi_note);
+  case Oevent_type_midi_cc:
+    return sizeof(Oevent_midi_cc);
+  case Oevent_type_midi_cc_interpolated:
+    return sizeof(Oevent_midi_cc_interpolated);
+  case Oevent_type_midi_pb:
+    return sizeof(Oevent_midi_pb);
+  case Oevent_type_osc_ints:
+    return sizeof(Oevent_osc_ints) + e->osc_ints.count;
+  case Oevent_type_udp_string:
+    return sizeof(Oevent_udp_string) + e->udp_string.count;
+  }
+  assert(0 && "unknown Oevent type");
+  return sizeof(Oevent_any);
+}
+
+// The events are packed back to back in a byte buffer, each one taking only
+// as many bytes as its own type needs, instead of an array of Oevent. Every
+// event type is made of bytes, so a record needs no alignment. Walk them with
+// oevent_list_begin() and oevent_list_next():
+//
+//   for (Oevent const *e = oevent_list_begin(olist); e;
+//        e = oevent_list_next(olist, e))
 typedef struct {
-  Oevent *buffer;
-  Usz count, capacity;
+  U8 *buffer;
+  Usz size, capacity; // in bytes
+  Usz count;          // number of events
 } Oevent_list;
 
 void oevent_list_init(Oevent_list *olist);
@@ -84,5 +122,17 @@ void oevent_list_deinit(Oevent_list *olist);
 void oevent_list_clear(Oevent_list *olist);
 ORCA_NOINLINE
 void oevent_list_copy(Oevent_list const *src, Oevent_list *dest);
+// Appends a record of size bytes, for the caller to fill in, starting with
+// the event type. For OSC and UDP events, size includes what follows the
+// header. The returned pointer is only good until the next call.
 ORCA_NOINLINE
-Oevent *oevent_list_alloc_item(Oevent_list *olist);
+Oevent *oevent_list_alloc_item(Oevent_list *olist, Usz size);
+
+static inline Oevent const *oevent_list_begin(Oevent_list const *olist) {
+  return olist->size ? (Oevent const *)olist->buffer : NULL;
+}
+static inline Oevent const *oevent_list_next(Oevent_list const *olist,
+                                             Oevent const *e) {
+  U8 const *next = (U8 const *)e + oevent_size(e);
+  return next < olist->buffer + olist->size ? (Oevent const *)next : NULL;
+}